@@ -0,0 +1,119 @@
+#include <array>
+
+#include "bindless.hpp"
+#include "util.h"
+
+
+BindlessHeap::BindlessHeap(vk::Device device, uint32_t maxImages, uint32_t maxBuffers): device(device) {
+	images.capacity = maxImages;
+	buffers.capacity = maxBuffers;
+
+	std::array<vk::DescriptorSetLayoutBinding, 2> bindings{};
+	bindings[0].binding = BINDLESS_IMAGE_BINDING;
+	bindings[0].descriptorType = vk::DescriptorType::eCombinedImageSampler;
+	bindings[0].descriptorCount = maxImages;
+	bindings[0].stageFlags = vk::ShaderStageFlagBits::eAll;
+	bindings[1].binding = BINDLESS_BUFFER_BINDING;
+	bindings[1].descriptorType = vk::DescriptorType::eStorageBuffer;
+	bindings[1].descriptorCount = maxBuffers;
+	bindings[1].stageFlags = vk::ShaderStageFlagBits::eAll;
+
+	// Slots may be updated while the set is bound, and unused slots may be left empty
+	vk::DescriptorBindingFlags flags = vk::DescriptorBindingFlagBits::eUpdateAfterBind | vk::DescriptorBindingFlagBits::ePartiallyBound;
+	std::array<vk::DescriptorBindingFlags, 2> bindingFlags{flags, flags};
+	vk::DescriptorSetLayoutBindingFlagsCreateInfo bindingFlagsInfo{};
+	bindingFlagsInfo.bindingCount = bindingFlags.size();
+	bindingFlagsInfo.pBindingFlags = bindingFlags.data();
+
+	vk::DescriptorSetLayoutCreateInfo layoutInfo{};
+	layoutInfo.flags = vk::DescriptorSetLayoutCreateFlagBits::eUpdateAfterBindPool;
+	layoutInfo.bindingCount = bindings.size();
+	layoutInfo.pBindings = bindings.data();
+	layoutInfo.pNext = &bindingFlagsInfo;
+	layout = device.createDescriptorSetLayoutUnique(layoutInfo);
+
+	std::array<vk::DescriptorPoolSize, 2> poolSizes {
+		vk::DescriptorPoolSize{vk::DescriptorType::eCombinedImageSampler, maxImages},
+		vk::DescriptorPoolSize{vk::DescriptorType::eStorageBuffer, maxBuffers},
+	};
+	vk::DescriptorPoolCreateInfo poolInfo{};
+	poolInfo.flags = vk::DescriptorPoolCreateFlagBits::eUpdateAfterBind;
+	poolInfo.maxSets = 1;
+	poolInfo.poolSizeCount = poolSizes.size();
+	poolInfo.pPoolSizes = poolSizes.data();
+	pool = device.createDescriptorPoolUnique(poolInfo);
+
+	vk::DescriptorSetAllocateInfo allocateInfo{};
+	allocateInfo.descriptorPool = *pool;
+	allocateInfo.descriptorSetCount = 1;
+	allocateInfo.pSetLayouts = &*layout;
+	set = device.allocateDescriptorSets(allocateInfo).at(0);
+}
+
+
+// Add a combined image sampler, returns its index in the image array
+uint32_t BindlessHeap::addImage(vk::ImageView view, vk::Sampler sampler, vk::ImageLayout imageLayout) {
+	std::lock_guard<std::mutex> lock(mutex);
+	uint32_t index = images.allocate();
+	vk::DescriptorImageInfo imageInfo{sampler, view, imageLayout};
+	vk::WriteDescriptorSet write{};
+	write.dstSet = set;
+	write.dstBinding = BINDLESS_IMAGE_BINDING;
+	write.dstArrayElement = index;
+	write.descriptorCount = 1;
+	write.descriptorType = vk::DescriptorType::eCombinedImageSampler;
+	write.pImageInfo = &imageInfo;
+	device.updateDescriptorSets(write, nullptr);
+	return index;
+}
+
+
+// Add a storage buffer range, returns its index in the buffer array
+uint32_t BindlessHeap::addBuffer(vk::Buffer buffer, vk::DeviceSize offset, vk::DeviceSize range) {
+	std::lock_guard<std::mutex> lock(mutex);
+	uint32_t index = buffers.allocate();
+	vk::DescriptorBufferInfo bufferInfo{buffer, offset, range};
+	vk::WriteDescriptorSet write{};
+	write.dstSet = set;
+	write.dstBinding = BINDLESS_BUFFER_BINDING;
+	write.dstArrayElement = index;
+	write.descriptorCount = 1;
+	write.descriptorType = vk::DescriptorType::eStorageBuffer;
+	write.pBufferInfo = &bufferInfo;
+	device.updateDescriptorSets(write, nullptr);
+	return index;
+}
+
+
+void BindlessHeap::removeImage(uint32_t index) {
+	std::lock_guard<std::mutex> lock(mutex);
+	images.release(index);
+}
+
+
+void BindlessHeap::removeBuffer(uint32_t index) {
+	std::lock_guard<std::mutex> lock(mutex);
+	buffers.release(index);
+}
+
+
+// Bind the set as set 0
+void BindlessHeap::bind(vk::CommandBuffer commandBuffer, vk::PipelineBindPoint bindPoint, vk::PipelineLayout pipelineLayout) {
+	commandBuffer.bindDescriptorSets(bindPoint, pipelineLayout, 0, set, nullptr);
+}
+
+
+uint32_t BindlessHeap::IndexAllocator::allocate() {
+	if (!freeList.empty()) {
+		uint32_t index = freeList.back();
+		freeList.pop_back();
+		return index;
+	}
+	assertThat((next < capacity), "Bindless descriptor array is full\n");
+	return next++;
+}
+
+
+void BindlessHeap::IndexAllocator::release(uint32_t index) {
+	freeList.push_back(index);
+}
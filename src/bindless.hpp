@@ -0,0 +1,59 @@
+#pragma once
+
+// Global bindless descriptor set
+// A single update-after-bind set with arrays of sampled images and storage buffers, shared by
+// every pipeline as set 0. Draws pick resources by passing array indices as push constants,
+// so nothing needs rebinding between materials or meshes.
+
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include <vulkan/vulkan.hpp>
+
+
+const uint32_t BINDLESS_IMAGE_BINDING = 0;
+const uint32_t BINDLESS_BUFFER_BINDING = 1;
+
+
+class BindlessHeap
+{
+public:
+	vk::UniqueDescriptorSetLayout layout{};
+	vk::UniqueDescriptorPool pool{};
+	vk::DescriptorSet set{};
+
+	BindlessHeap(vk::Device device, uint32_t maxImages, uint32_t maxBuffers);
+
+	// Add a combined image sampler, returns its index in the image array
+	uint32_t addImage(vk::ImageView view, vk::Sampler sampler, vk::ImageLayout imageLayout = vk::ImageLayout::eShaderReadOnlyOptimal);
+
+	// Add a storage buffer range, returns its index in the buffer array
+	uint32_t addBuffer(vk::Buffer buffer, vk::DeviceSize offset = 0, vk::DeviceSize range = VK_WHOLE_SIZE);
+
+	// Make an index available for reuse
+	// Descriptors are partially bound, so the slot can stay stale as long as no
+	// recorded or in-flight command buffer still uses it, so release through VulkanState::runLater
+	void removeImage(uint32_t index);
+	void removeBuffer(uint32_t index);
+
+	// Bind the set as set 0, valid for every pipeline made while the heap exists
+	void bind(vk::CommandBuffer commandBuffer, vk::PipelineBindPoint bindPoint, vk::PipelineLayout pipelineLayout);
+
+private:
+	// Hands out array indices, reusing removed ones first
+	struct IndexAllocator {
+		uint32_t capacity = 0;
+		uint32_t next = 0;
+		std::vector<uint32_t> freeList{};
+
+		uint32_t allocate();
+		void release(uint32_t index);
+	};
+
+	vk::Device device;
+	// Descriptor updates may come from loader threads
+	std::mutex mutex;
+	IndexAllocator images{};
+	IndexAllocator buffers{};
+};
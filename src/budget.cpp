@@ -0,0 +1,206 @@
+#include <algorithm>
+
+#include "budget.hpp"
+
+// Frames a resource has to go unused before the soft limit evicts it, and frames to leave a heap
+// alone after evicting from it, until the freed memory is actually released. Covers the frames
+// in flight that may still use a resource, see MAX_FRAMES_IN_FLIGHT.
+static const uint64_t EVICTION_FRAMES = 3;
+
+
+// Set up tracking for a device
+void MemoryBudget::init(vk::PhysicalDevice physicalDevice, bool budgetExtension, const HeapCounters &counters) {
+	std::lock_guard<std::mutex> lock{mutex};
+	this->physicalDevice = physicalDevice;
+	this->budgetExtension = budgetExtension;
+	this->counters = &counters;
+	renderThread = std::this_thread::get_id();
+	refresh();
+	lastEviction.assign(heapState.size(), 0);
+}
+
+
+// Query usage and budgets
+void MemoryBudget::refresh() {
+	heapState.clear();
+	countedAtRefresh.clear();
+	if (budgetExtension) {
+		auto properties = physicalDevice.getMemoryProperties2<vk::PhysicalDeviceMemoryProperties2, vk::PhysicalDeviceMemoryBudgetPropertiesEXT>();
+		auto &memoryProperties = properties.get<vk::PhysicalDeviceMemoryProperties2>().memoryProperties;
+		auto &budgets = properties.get<vk::PhysicalDeviceMemoryBudgetPropertiesEXT>();
+		for (uint32_t i = 0; i < memoryProperties.memoryHeapCount; i++) {
+			heapState.push_back({memoryProperties.memoryHeaps[i].size, budgets.heapBudget[i], budgets.heapUsage[i]});
+			countedAtRefresh.push_back(counters->bytes[i]);
+		}
+	} else {
+		// Without the extension all we know is the heap size and what we allocated ourselves
+		auto memoryProperties = physicalDevice.getMemoryProperties();
+		for (uint32_t i = 0; i < memoryProperties.memoryHeapCount; i++) {
+			auto size = memoryProperties.memoryHeaps[i].size;
+			heapState.push_back({size, size, counters->bytes[i]});
+			countedAtRefresh.push_back(counters->bytes[i]);
+		}
+	}
+}
+
+
+// Usage of a heap including our allocations since the last refresh, must hold the mutex
+vk::DeviceSize MemoryBudget::usage(uint32_t heap) const {
+	int64_t change = (int64_t) counters->bytes[heap] - (int64_t) countedAtRefresh.at(heap);
+	return (vk::DeviceSize) std::max((int64_t) heapState.at(heap).usage + change, (int64_t) 0);
+}
+
+
+// Run queued evictions, query usage and budgets, and evict until heaps are under their soft limit
+void MemoryBudget::update(uint64_t frame) {
+	std::vector<std::function<void()>> queued{};
+	{
+		std::lock_guard<std::mutex> lock{mutex};
+		for (auto it = evictables.begin(); it != evictables.end();) {
+			if (it->second.queued) {
+				queued.push_back(std::move(it->second.evict));
+				it = evictables.erase(it);
+			} else {
+				it++;
+			}
+		}
+	}
+	// Outside the lock, so the callbacks can register replacements
+	for (auto &evict: queued) {
+		evict();
+	}
+
+	std::vector<std::pair<uint32_t, vk::DeviceSize>> excess{};
+	{
+		std::lock_guard<std::mutex> lock{mutex};
+		this->frame = frame;
+		refresh();
+		for (uint32_t heap = 0; heap < heapState.size(); heap++) {
+			auto limit = (vk::DeviceSize) (heapState[heap].budget * softLimit);
+			auto used = usage(heap);
+			if (used > limit && frame >= lastEviction[heap] + EVICTION_FRAMES) {
+				excess.push_back({heap, used - limit});
+			}
+		}
+	}
+
+	for (auto [heap, bytes]: excess) {
+		// Only resources no frame in flight uses, so they are freed in time for the next check
+		uint64_t usedBefore = frame >= EVICTION_FRAMES ? frame - EVICTION_FRAMES + 1 : 0;
+		vk::DeviceSize freed = 0;
+		while (freed < bytes) {
+			auto size = evictOldest(heap, usedBefore);
+			if (size == 0) {
+				break;
+			}
+			freed += size;
+		}
+	}
+}
+
+
+// Current state of every heap
+std::vector<MemoryBudget::Heap> MemoryBudget::heaps() const {
+	std::lock_guard<std::mutex> lock{mutex};
+	std::vector<Heap> result = heapState;
+	for (uint32_t heap = 0; heap < result.size(); heap++) {
+		result[heap].usage = usage(heap);
+	}
+	return result;
+}
+
+
+// Whether an allocation fits under the hard limit of a heap
+bool MemoryBudget::fits(uint32_t heap, vk::DeviceSize size) const {
+	std::lock_guard<std::mutex> lock{mutex};
+	return usage(heap) + size <= heapState.at(heap).budget * hardLimit;
+}
+
+
+// Whether an allocation fits under the soft limit of a heap
+bool MemoryBudget::hasHeadroom(uint32_t heap, vk::DeviceSize size) const {
+	std::lock_guard<std::mutex> lock{mutex};
+	return usage(heap) + size <= heapState.at(heap).budget * softLimit;
+}
+
+
+// Queue least recently used resources of a heap for eviction until an allocation fits
+bool MemoryBudget::makeRoom(uint32_t heap, vk::DeviceSize size) {
+	std::lock_guard<std::mutex> lock{mutex};
+	// Evicted memory is freed a few frames later, count it as gone already,
+	// including what earlier calls queued
+	vk::DeviceSize freed = 0;
+	for (auto &[handle, evictable]: evictables) {
+		if (evictable.queued && evictable.heap == heap) {
+			freed += evictable.size;
+		}
+	}
+	while (usage(heap) + size > heapState.at(heap).budget * hardLimit + freed) {
+		auto found = oldest(heap, UINT64_MAX);
+		if (found == evictables.end()) {
+			return false;
+		}
+		found->second.queued = true;
+		freed += found->second.size;
+		lastEviction.at(heap) = frame;
+	}
+	return true;
+}
+
+
+// Register a resource that can be dropped under memory pressure
+EvictionHandle MemoryBudget::add(uint32_t heap, vk::DeviceSize size, std::function<void()> evict) {
+	std::lock_guard<std::mutex> lock{mutex};
+	EvictionHandle handle = nextHandle++;
+	evictables[handle] = {heap, size, frame, std::move(evict)};
+	return handle;
+}
+
+
+// Mark a resource as used in the current frame
+void MemoryBudget::touch(EvictionHandle handle) {
+	std::lock_guard<std::mutex> lock{mutex};
+	auto found = evictables.find(handle);
+	if (found != evictables.end()) {
+		found->second.lastUsed = frame;
+	}
+}
+
+
+// Unregister a resource
+void MemoryBudget::remove(EvictionHandle handle) {
+	std::lock_guard<std::mutex> lock{mutex};
+	evictables.erase(handle);
+}
+
+
+// Least recently used resource of a heap that isn't queued for eviction yet
+std::map<EvictionHandle, MemoryBudget::Evictable>::iterator MemoryBudget::oldest(uint32_t heap, uint64_t usedBefore) {
+	auto found = evictables.end();
+	for (auto it = evictables.begin(); it != evictables.end(); it++) {
+		bool candidate = it->second.heap == heap && it->second.lastUsed < usedBefore && !it->second.queued;
+		if (candidate && (found == evictables.end() || it->second.lastUsed < found->second.lastUsed)) {
+			found = it;
+		}
+	}
+	return found;
+}
+
+
+// Evict the least recently used resource of a heap, returns its size or 0 if there was none
+vk::DeviceSize MemoryBudget::evictOldest(uint32_t heap, uint64_t usedBefore) {
+	Evictable evicted{};
+	{
+		std::lock_guard<std::mutex> lock{mutex};
+		auto found = oldest(heap, usedBefore);
+		if (found == evictables.end()) {
+			return 0;
+		}
+		evicted = std::move(found->second);
+		evictables.erase(found);
+		lastEviction.at(heap) = frame;
+	}
+	// Outside the lock, so the callback can register replacements
+	evicted.evict();
+	return evicted.size;
+}
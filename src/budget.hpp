@@ -0,0 +1,122 @@
+#pragma once
+
+// GPU memory budget tracking and eviction
+// Usage and budget of each heap come from VK_EXT_memory_budget when the device has it, which
+// also covers other processes, otherwise from our own allocation counters against the heap size.
+// Streamed resources register an eviction callback, and are dropped least recently used first
+// when a heap goes over its soft limit, or when an allocation would take it over the hard limit.
+// Callbacks only run from update, so an allocation made while a frame is being recorded never
+// drops a resource that frame is drawing.
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <vulkan/vulkan.hpp>
+
+#include "stats.hpp"
+
+
+// Identifies a resource registered for eviction
+using EvictionHandle = uint64_t;
+
+
+class MemoryBudget
+{
+public:
+	// Usage each heap is kept under, as fractions of its budget
+	// Going over the soft limit evicts resources that weren't used in the last frames,
+	// an allocation that would go over the hard limit evicts any resource to make room
+	float softLimit = 0.8f;
+	float hardLimit = 0.95f;
+
+	struct Heap {
+		vk::DeviceSize size;
+		// Memory this process may use, and how much it does
+		vk::DeviceSize budget;
+		vk::DeviceSize usage;
+	};
+
+	// Set up tracking for a device, with our own allocations counted in counters
+	void init(vk::PhysicalDevice physicalDevice, bool budgetExtension, const HeapCounters &counters);
+
+	// Run evictions queued by makeRoom, query usage and budgets, and evict until heaps are under
+	// their soft limit. Call once per frame on the thread recording frames, after the frame's fence
+	// was waited for and before recording starts.
+	void update(uint64_t frame);
+
+	// Current state of every heap, as of the last update
+	std::vector<Heap> heaps() const;
+
+	// Whether an allocation of the given size fits under the hard limit of a heap
+	bool fits(uint32_t heap, vk::DeviceSize size) const;
+
+	// Whether an allocation of the given size fits under the soft limit, so bringing back an
+	// evicted resource of that size won't get it evicted again right away
+	bool hasHeadroom(uint32_t heap, vk::DeviceSize size) const;
+
+	// Queue least recently used resources of a heap for eviction until the given number of bytes
+	// fits under its hard limit, or nothing is left to evict. Returns whether it will fit once the
+	// queued evictions were freed. Safe from any thread, the callbacks run in the next update.
+	bool makeRoom(uint32_t heap, vk::DeviceSize size);
+
+	// Whether this is the thread init was called on, which records frames
+	bool onRenderThread() const {
+		return std::this_thread::get_id() == renderThread;
+	}
+
+	// Register a resource of the given size that can be dropped under memory pressure
+	// The callback should release the resource with VulkanState::destroyLater; the
+	// registration is removed before it runs, and a queued eviction of a removed resource is dropped
+	EvictionHandle add(uint32_t heap, vk::DeviceSize size, std::function<void()> evict);
+
+	// Mark a resource as used in the current frame
+	void touch(EvictionHandle handle);
+
+	// Unregister a resource that is freed for other reasons
+	void remove(EvictionHandle handle);
+
+private:
+	struct Evictable {
+		uint32_t heap;
+		vk::DeviceSize size;
+		uint64_t lastUsed;
+		std::function<void()> evict;
+		// Picked by makeRoom, runs in the next update
+		bool queued = false;
+	};
+
+	vk::PhysicalDevice physicalDevice{};
+	bool budgetExtension = false;
+	const HeapCounters *counters = nullptr;
+	std::thread::id renderThread{};
+
+	// Loader threads allocate too
+	mutable std::mutex mutex;
+	std::vector<Heap> heapState{};
+	// Our own allocation counters at the last refresh, to keep usage current in between
+	std::vector<vk::DeviceSize> countedAtRefresh{};
+	// Evicted memory is only freed once frames in flight are done, so heaps aren't evicted
+	// from again for their soft limit until then
+	std::vector<uint64_t> lastEviction{};
+	uint64_t frame = 0;
+	EvictionHandle nextHandle = 1;
+	std::map<EvictionHandle, Evictable> evictables{};
+
+	// Query usage and budgets, must hold the mutex
+	void refresh();
+
+	// Usage of a heap including our allocations since the last refresh, must hold the mutex
+	vk::DeviceSize usage(uint32_t heap) const;
+
+	// Least recently used resource of a heap last used before the given frame that isn't queued
+	// for eviction yet, or evictables.end() if there is none. Must hold the mutex.
+	std::map<EvictionHandle, Evictable>::iterator oldest(uint32_t heap, uint64_t usedBefore);
+
+	// Evict the least recently used resource of a heap last used before the given frame
+	// Returns its size, or 0 if there is none. Must not hold the mutex.
+	vk::DeviceSize evictOldest(uint32_t heap, uint64_t usedBefore);
+};
@@ -0,0 +1,192 @@
+#include <cstdio>
+
+#include "capture.hpp"
+
+
+// Whether a color format can be written out, and if its channels need swapping to RGB
+static bool isCapturable(vk::Format format, bool &bgr) {
+	switch (format) {
+	case vk::Format::eB8G8R8A8Unorm:
+	case vk::Format::eB8G8R8A8Srgb:
+		bgr = true;
+		return true;
+	case vk::Format::eR8G8B8A8Unorm:
+	case vk::Format::eR8G8B8A8Srgb:
+		bgr = false;
+		return true;
+	default:
+		return false;
+	}
+}
+
+
+FrameCapture::FrameCapture(VulkanState &vulkan, std::filesystem::path directory, size_t ringSize):
+	vulkan(vulkan),
+	directory(directory),
+	slots(ringSize)
+{
+	std::filesystem::create_directories(directory);
+	writer = std::thread([this] { writeLoop(); });
+}
+
+
+FrameCapture::~FrameCapture() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	wake.notify_all();
+	writer.join();
+}
+
+
+// Record a copy of the rendered color target into a free readback buffer
+// Skips the frame instead of waiting if all buffers are still in use
+void FrameCapture::record(vk::CommandBuffer commandBuffer) {
+	bool bgr;
+	if (!isCapturable(vulkan.colorFormat, bgr)) {
+		if (skipped++ == 0) {
+			fprintf(stderr, "Frame capture does not support the color target format\n");
+		}
+		return;
+	}
+
+	Slot *slot = nullptr;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		for (auto &candidate: slots) {
+			if (candidate.state == SlotState::Free) {
+				slot = &candidate;
+				break;
+			}
+		}
+	}
+	if (slot == nullptr) {
+		skipped++;
+		return;
+	}
+
+	// Free slots are not touched by the GPU or the writer, so can be (re)allocated here
+	// Size for the full view extent so changing the render scale doesn't reallocate
+	vk::DeviceSize size = (vk::DeviceSize) vulkan.viewExtent.width * vulkan.viewExtent.height * 4;
+	if (slot->size < size) {
+		slot->buffer = vulkan.createBuffer(
+			vk::BufferUsageFlagBits::eTransferDst,
+			size,
+			vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent
+		);
+		slot->mapped = static_cast<uint8_t*>(vulkan.device->mapMemory(*slot->buffer.memory, 0, size, {}));
+		slot->size = size;
+	}
+
+	slot->extent = vulkan.renderExtent;
+	slot->format = vulkan.colorFormat;
+	slot->frameIndex = vulkan.currentFrame;
+	slot->frameNumber = frameNumber++;
+
+	vk::BufferImageCopy region{};
+	region.bufferOffset = 0;
+	region.bufferRowLength = 0;
+	region.bufferImageHeight = 0;
+	// Only the first view is captured when rendering several
+	region.imageSubresource = vk::ImageSubresourceLayers{vk::ImageAspectFlagBits::eColor, 0, 0, 1};
+	region.imageOffset = vk::Offset3D(0, 0, 0);
+	region.imageExtent = vk::Extent3D(slot->extent.width, slot->extent.height, 1);
+	commandBuffer.copyImageToBuffer(
+		*vulkan.colorTarget.image,
+		vk::ImageLayout::eTransferSrcOptimal,
+		*slot->buffer.buffer,
+		region
+	);
+
+	// Make the copy visible to the writer thread once the frame fence signals
+	vk::BufferMemoryBarrier hostBarrier{};
+	hostBarrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+	hostBarrier.dstAccessMask = vk::AccessFlagBits::eHostRead;
+	hostBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	hostBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	hostBarrier.buffer = *slot->buffer.buffer;
+	hostBarrier.offset = 0;
+	hostBarrier.size = VK_WHOLE_SIZE;
+	commandBuffer.pipelineBarrier(
+		vk::PipelineStageFlagBits::eTransfer,
+		vk::PipelineStageFlagBits::eHost,
+		{}, nullptr, hostBarrier, nullptr
+	);
+
+	std::lock_guard<std::mutex> lock(mutex);
+	slot->state = SlotState::Recorded;
+	captured++;
+}
+
+
+// Pass captures of a finished in-flight frame to the writer thread
+void FrameCapture::collect(size_t frameIndex) {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		for (size_t i = 0; i < slots.size(); i++) {
+			if (slots[i].state == SlotState::Recorded && slots[i].frameIndex == frameIndex) {
+				slots[i].state = SlotState::Writing;
+				writeQueue.push_back(i);
+			}
+		}
+	}
+	wake.notify_one();
+}
+
+
+// Pass all recorded captures to the writer thread
+void FrameCapture::flush() {
+	for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+		collect(i);
+	}
+}
+
+
+// Writer thread, writes out queued captures until stopped and the queue is drained
+void FrameCapture::writeLoop() {
+	std::unique_lock<std::mutex> lock(mutex);
+	while (true) {
+		wake.wait(lock, [this] { return stopping || !writeQueue.empty(); });
+		if (writeQueue.empty()) {
+			return;
+		}
+		size_t index = writeQueue.front();
+		writeQueue.pop_front();
+
+		// Slot is owned by this thread while writing, so no need to hold the lock
+		lock.unlock();
+		writeImage(slots[index]);
+		lock.lock();
+
+		slots[index].state = SlotState::Free;
+	}
+}
+
+
+// Write a slot's contents as a binary PPM file
+void FrameCapture::writeImage(Slot &slot) {
+	char name[32];
+	snprintf(name, sizeof(name), "frame_%06zu.ppm", slot.frameNumber);
+	auto path = directory / name;
+	FILE *file = fopen(path.c_str(), "wb");
+	if (file == nullptr) {
+		fprintf(stderr, "Could not write capture %s\n", path.c_str());
+		return;
+	}
+
+	bool bgr = false;
+	isCapturable(slot.format, bgr);
+	fprintf(file, "P6\n%u %u\n255\n", slot.extent.width, slot.extent.height);
+	std::vector<uint8_t> row(slot.extent.width * 3);
+	for (uint32_t y = 0; y < slot.extent.height; y++) {
+		const uint8_t *pixel = slot.mapped + (size_t) y * slot.extent.width * 4;
+		for (uint32_t x = 0; x < slot.extent.width; x++, pixel += 4) {
+			row[x * 3 + 0] = pixel[bgr ? 2 : 0];
+			row[x * 3 + 1] = pixel[1];
+			row[x * 3 + 2] = pixel[bgr ? 0 : 2];
+		}
+		fwrite(row.data(), 1, row.size(), file);
+	}
+	fclose(file);
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+// Asynchronous frame capture
+// The rendered image is copied into a ring of host visible buffers as part of the frame's
+// command buffer, and written to disk on a background thread once the frame has finished.
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "vulkan.hpp"
+
+
+class FrameCapture
+{
+public:
+	// Frames written so far, and frames skipped because no readback buffer was free
+	size_t captured = 0;
+	size_t skipped = 0;
+
+	// Write captured frames as PPM images into the given directory
+	FrameCapture(VulkanState &vulkan, std::filesystem::path directory, size_t ringSize = MAX_FRAMES_IN_FLIGHT + 2);
+	~FrameCapture();
+
+	// Record a copy of the rendered color target into a free readback buffer
+	// The color target must be in transfer source layout
+	void record(vk::CommandBuffer commandBuffer);
+
+	// Pass captures of an in-flight frame to the writer thread
+	// Call once the frame's fence has been waited for
+	void collect(size_t frameIndex);
+
+	// Pass all recorded captures to the writer thread, the device must be idle
+	void flush();
+
+private:
+	enum class SlotState {
+		// Can be recorded into
+		Free,
+		// Copy recorded, waiting for the GPU to finish the frame
+		Recorded,
+		// Owned by the writer thread
+		Writing,
+	};
+
+	// Readback buffer with the metadata of the frame it holds
+	struct Slot {
+		BufferAndMemory buffer{};
+		vk::DeviceSize size = 0;
+		uint8_t *mapped = nullptr;
+		SlotState state = SlotState::Free;
+		size_t frameIndex = 0;
+		size_t frameNumber = 0;
+		vk::Extent2D extent{};
+		vk::Format format{};
+	};
+
+	VulkanState &vulkan;
+	std::filesystem::path directory;
+	std::vector<Slot> slots;
+	size_t frameNumber = 0;
+
+	// Guards slot states and the write queue, shared with the writer thread
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::deque<size_t> writeQueue;
+	bool stopping = false;
+	std::thread writer;
+
+	void writeLoop();
+	void writeImage(Slot &slot);
+};
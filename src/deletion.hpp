@@ -0,0 +1,55 @@
+#pragma once
+
+// Deferred destruction of GPU resources
+// Resources released while frame N is current may still be used by command buffers of
+// frames in flight, so they are kept alive until frame N's fence has been waited for,
+// instead of draining the whole GPU before freeing them.
+
+#include <array>
+#include <functional>
+#include <memory>
+#include <vector>
+
+
+template<size_t FrameCount>
+class DeletionQueue
+{
+public:
+	// Keep a resource alive until the given frame has finished
+	// Takes ownership, so pass Unique handles, BufferAndMemory, Pipeline and the like with std::move
+	template<typename T>
+	void destroy(size_t frameIndex, T resource) {
+		auto held = std::make_shared<T>(std::move(resource));
+		defer(frameIndex, [held]() mutable { held.reset(); });
+	}
+
+	// Run a function once the given frame has finished, for releases that aren't plain
+	// destructors, like freeing a bindless index
+	void defer(size_t frameIndex, std::function<void()> function) {
+		pending.at(frameIndex).push_back(std::move(function));
+	}
+
+	// Free everything released during the given frame, its fence must have been waited for
+	void collect(size_t frameIndex) {
+		// Swap out first, so releases can queue more releases for a later frame
+		std::vector<std::function<void()>> functions{};
+		std::swap(functions, pending.at(frameIndex));
+		for (auto &function: functions) {
+			function();
+		}
+	}
+
+	// Free everything, the device must be idle
+	void flush() {
+		for (size_t i = 0; i < FrameCount; i++) {
+			collect(i);
+		}
+	}
+
+	~DeletionQueue() {
+		flush();
+	}
+
+private:
+	std::array<std::vector<std::function<void()>>, FrameCount> pending{};
+};
@@ -0,0 +1,245 @@
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <tuple>
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include "device.hpp"
+#include "vulkan.hpp"
+
+
+// Format a device UUID the usual way, as 8-4-4-4-12 hex digits
+static std::string formatUuid(const uint8_t *uuid) {
+	std::string result{};
+	char hex[3];
+	for (size_t i = 0; i < VK_UUID_SIZE; i++) {
+		if (i == 4 || i == 6 || i == 8 || i == 10) {
+			result += '-';
+		}
+		snprintf(hex, sizeof(hex), "%02x", uuid[i]);
+		result += hex;
+	}
+	return result;
+}
+
+
+static std::string toLower(std::string text) {
+	std::transform(text.begin(), text.end(), text.begin(), [](unsigned char c) { return std::tolower(c); });
+	return text;
+}
+
+
+// Check for the descriptor indexing features used by the bindless heap
+// Core in Vulkan 1.2, an extension on 1.1 devices
+static bool supportsBindless(const DeviceProfile &profile) {
+	if (
+		profile.apiVersion < VK_API_VERSION_1_1 ||
+		(profile.apiVersion < VK_API_VERSION_1_2 && !profile.hasExtension("VK_EXT_descriptor_indexing"))
+	) {
+		return false;
+	}
+	auto features = profile.physicalDevice.getFeatures2<vk::PhysicalDeviceFeatures2, vk::PhysicalDeviceDescriptorIndexingFeatures>();
+	auto &indexing = features.get<vk::PhysicalDeviceDescriptorIndexingFeatures>();
+	// Indices come from push constants, so arrays are indexed with dynamically uniform values
+	return (
+		profile.features.shaderSampledImageArrayDynamicIndexing &&
+		profile.features.shaderStorageBufferArrayDynamicIndexing &&
+		indexing.runtimeDescriptorArray &&
+		indexing.descriptorBindingPartiallyBound &&
+		indexing.descriptorBindingSampledImageUpdateAfterBind &&
+		indexing.descriptorBindingStorageBufferUpdateAfterBind
+	);
+}
+
+
+bool DeviceProfile::hasExtension(const char *name) const {
+	for (auto &extension: extensions) {
+		if (strcmp(extension.extensionName, name) == 0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+
+// Gather the capabilities of a physical device
+DeviceProfile profileDevice(vk::Instance instance, vk::PhysicalDevice physicalDevice, uint32_t instanceVersion) {
+	DeviceProfile profile{};
+	profile.physicalDevice = physicalDevice;
+	profile.properties = physicalDevice.getProperties();
+	profile.features = physicalDevice.getFeatures();
+	profile.apiVersion = std::min(instanceVersion, profile.properties.apiVersion);
+	profile.extensions = physicalDevice.enumerateDeviceExtensionProperties();
+	profile.queueFamilies = physicalDevice.getQueueFamilyProperties();
+
+	if (instanceVersion >= VK_API_VERSION_1_1) {
+		auto properties = physicalDevice.getProperties2<vk::PhysicalDeviceProperties2, vk::PhysicalDeviceIDProperties>();
+		profile.uuid = formatUuid(&properties.get<vk::PhysicalDeviceIDProperties>().deviceUUID[0]);
+	}
+
+	auto memoryProperties = physicalDevice.getMemoryProperties();
+	for (uint32_t i = 0; i < memoryProperties.memoryHeapCount; i++) {
+		auto &heap = memoryProperties.memoryHeaps[i];
+		if (heap.flags & vk::MemoryHeapFlagBits::eDeviceLocal) {
+			profile.deviceLocalMemory = std::max(profile.deviceLocalMemory, heap.size);
+		}
+	}
+
+	// Hard requirements
+	auto graphicsFamily = pickQueueFamily(profile.queueFamilies);
+	for (auto extension: REQUIRED_DEVICE_EXTENSIONS) {
+		if (!profile.hasExtension(extension)) {
+			profile.unsuitableReason = std::string("missing extension ") + extension;
+		}
+	}
+	if (!graphicsFamily) {
+		profile.unsuitableReason = "no graphics queue";
+	} else if (!glfwGetPhysicalDevicePresentationSupport(static_cast<VkInstance>(instance), static_cast<VkPhysicalDevice>(physicalDevice), *graphicsFamily)) {
+		// Frames are presented from the graphics queue, see VulkanState::setSurface
+		profile.unsuitableReason = "graphics queue can't present";
+	} else if (!profile.features.largePoints) {
+		profile.unsuitableReason = "no support for large points";
+	} else if (profile.properties.limits.maxPushConstantsSize < BINDLESS_PUSH_CONSTANT_SIZE) {
+		profile.unsuitableReason = "push constant space too small";
+	}
+
+	// Optional capabilities
+	profile.bindless = supportsBindless(profile);
+	profile.tessellation = profile.features.tessellationShader;
+	profile.asyncCompute = pickDedicatedQueueFamily(
+		profile.queueFamilies,
+		vk::QueueFlagBits::eCompute,
+		vk::QueueFlagBits::eGraphics
+	).has_value();
+	profile.timestamps = graphicsFamily && profile.queueFamilies.at(*graphicsFamily).timestampValidBits > 0;
+	// Multiview is core since Vulkan 1.1
+	if (profile.apiVersion >= VK_API_VERSION_1_1) {
+		auto features = physicalDevice.getFeatures2<vk::PhysicalDeviceFeatures2, vk::PhysicalDeviceMultiviewFeatures>();
+		auto properties = physicalDevice.getProperties2<vk::PhysicalDeviceProperties2, vk::PhysicalDeviceMultiviewProperties>();
+		profile.multiview = features.get<vk::PhysicalDeviceMultiviewFeatures>().multiview;
+		if (profile.multiview) {
+			profile.maxViews = properties.get<vk::PhysicalDeviceMultiviewProperties>().maxMultiviewViewCount;
+		}
+	}
+	// Budgets are queried through getMemoryProperties2, core since Vulkan 1.1
+	profile.memoryBudget = profile.apiVersion >= VK_API_VERSION_1_1 && profile.hasExtension("VK_EXT_memory_budget");
+	// Dynamic rendering builds on extensions that are core since Vulkan 1.2
+	if (profile.apiVersion >= VK_API_VERSION_1_2 && profile.hasExtension("VK_KHR_dynamic_rendering")) {
+		auto features = physicalDevice.getFeatures2<vk::PhysicalDeviceFeatures2, vk::PhysicalDeviceDynamicRenderingFeaturesKHR>();
+		profile.dynamicRendering = features.get<vk::PhysicalDeviceDynamicRenderingFeaturesKHR>().dynamicRendering;
+	}
+	return profile;
+}
+
+
+// Score for comparing devices, compared in order: device type, memory, optional capabilities
+static std::tuple<int, vk::DeviceSize, int> scoreDevice(const DeviceProfile &profile) {
+	int typeScore = 0;
+	switch (profile.properties.deviceType) {
+	case vk::PhysicalDeviceType::eDiscreteGpu:
+		typeScore = 4;
+		break;
+	case vk::PhysicalDeviceType::eIntegratedGpu:
+		typeScore = 3;
+		break;
+	case vk::PhysicalDeviceType::eVirtualGpu:
+		typeScore = 2;
+		break;
+	case vk::PhysicalDeviceType::eCpu:
+		// Software renderers
+		typeScore = 1;
+		break;
+	default:
+		break;
+	}
+	int optionalScore = profile.bindless + profile.tessellation + profile.asyncCompute + profile.timestamps + profile.multiview;
+	return {typeScore, profile.deviceLocalMemory, optionalScore};
+}
+
+
+// Pick the device matching the override by name or UUID if given, otherwise the best suitable one
+const DeviceProfile *pickDevice(std::vector<DeviceProfile> &profiles, const char *deviceOverride) {
+	if (deviceOverride != nullptr && deviceOverride[0] != '\0') {
+		std::string wanted = toLower(deviceOverride);
+		for (auto &profile: profiles) {
+			bool matches = (
+				toLower(&profile.properties.deviceName[0]).find(wanted) != std::string::npos ||
+				(!profile.uuid.empty() && profile.uuid == wanted)
+			);
+			if (!matches) {
+				continue;
+			}
+			if (!profile.suitable()) {
+				fprintf(stderr, "Requested device %s can't be used: %s\n", &profile.properties.deviceName[0], profile.unsuitableReason.c_str());
+				return nullptr;
+			}
+			return &profile;
+		}
+		fprintf(stderr, "No device matches \"%s\", picking one automatically\n", deviceOverride);
+	}
+
+	const DeviceProfile *best = nullptr;
+	for (auto &profile: profiles) {
+		if (profile.suitable() && (best == nullptr || scoreDevice(profile) > scoreDevice(*best))) {
+			best = &profile;
+		}
+	}
+	return best;
+}
+
+
+// Log the capabilities of the device we're running on
+void printDeviceProfile(const DeviceProfile &profile) {
+	auto yesNo = [](bool value) { return value ? "yes" : "no"; };
+	printf(
+		"Using %s (%s, Vulkan %u.%u, %llu MiB device local)\n",
+		&profile.properties.deviceName[0],
+		vk::to_string(profile.properties.deviceType).c_str(),
+		VK_VERSION_MAJOR(profile.apiVersion),
+		VK_VERSION_MINOR(profile.apiVersion),
+		(unsigned long long) (profile.deviceLocalMemory / (1024 * 1024))
+	);
+	if (!profile.uuid.empty()) {
+		printf("  UUID %s\n", profile.uuid.c_str());
+	}
+	printf(
+		"  bindless: %s, tessellation: %s, async compute: %s, timestamps: %s, multiview: %s, memory budget: %s, dynamic rendering: %s, push constants: %u bytes\n",
+		yesNo(profile.bindless),
+		yesNo(profile.tessellation),
+		yesNo(profile.asyncCompute),
+		yesNo(profile.timestamps),
+		yesNo(profile.multiview),
+		yesNo(profile.memoryBudget),
+		yesNo(profile.dynamicRendering),
+		profile.properties.limits.maxPushConstantsSize
+	);
+}
+
+
+// Pick a queue family that supports graphics
+std::optional<uint32_t> pickQueueFamily(const std::vector<vk::QueueFamilyProperties> &queueFamilies) {
+	// Pick any queue family that supports graphics
+	for (size_t i = 0; i < queueFamilies.size(); i++) {
+		if (queueFamilies.at(i).queueFlags & vk::QueueFlagBits::eGraphics)
+			return i;
+	}
+	return {};
+}
+
+
+// Pick a queue family with the required flags and none of the excluded ones
+std::optional<uint32_t> pickDedicatedQueueFamily(
+	const std::vector<vk::QueueFamilyProperties> &queueFamilies,
+	vk::QueueFlags required,
+	vk::QueueFlags excluded
+) {
+	for (size_t i = 0; i < queueFamilies.size(); i++) {
+		auto flags = queueFamilies.at(i).queueFlags;
+		if ((flags & required) == required && !(flags & excluded))
+			return i;
+	}
+	return {};
+}
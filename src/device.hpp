@@ -0,0 +1,78 @@
+#pragma once
+
+// Physical device selection
+// Profiles the capabilities of each device and picks the fastest suitable one,
+// unless a specific device is asked for by name or UUID
+
+#include <array>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <vulkan/vulkan.hpp>
+
+
+// Device extensions we can't run without
+static const std::array<const char*, 1> REQUIRED_DEVICE_EXTENSIONS {
+	"VK_KHR_swapchain",
+};
+
+
+// Capabilities of a physical device that matter for picking one
+struct DeviceProfile {
+	vk::PhysicalDevice physicalDevice{};
+	vk::PhysicalDeviceProperties properties{};
+	vk::PhysicalDeviceFeatures features{};
+	// Vulkan version usable with the device, limited by the instance version
+	uint32_t apiVersion = 0;
+	// Device UUID as hex string, empty if the instance can't query it
+	std::string uuid{};
+	// Size of the largest device local memory heap
+	vk::DeviceSize deviceLocalMemory = 0;
+	std::vector<vk::ExtensionProperties> extensions{};
+	std::vector<vk::QueueFamilyProperties> queueFamilies{};
+	// Why the device can't be used, empty if it can
+	std::string unsuitableReason{};
+
+	// Optional capabilities
+	bool bindless = false;
+	bool tessellation = false;
+	bool asyncCompute = false;
+	bool timestamps = false;
+	// Rendering to several views in one pass, and how many
+	bool multiview = false;
+	uint32_t maxViews = 1;
+	// Heap budgets and usage of the whole system from VK_EXT_memory_budget
+	bool memoryBudget = false;
+	// Rendering without render pass and frame buffer objects, from VK_KHR_dynamic_rendering
+	bool dynamicRendering = false;
+
+	bool suitable() const {
+		return unsuitableReason.empty();
+	}
+
+	bool hasExtension(const char *name) const;
+};
+
+
+// Gather the capabilities of a physical device
+// GLFW must be initialized, it tells whether the device can present to its windows
+DeviceProfile profileDevice(vk::Instance instance, vk::PhysicalDevice physicalDevice, uint32_t instanceVersion);
+
+// Pick the device matching the override by name or UUID if given, otherwise the best suitable one
+// Returns null if there is no usable device
+const DeviceProfile *pickDevice(std::vector<DeviceProfile> &profiles, const char *deviceOverride);
+
+// Log the capabilities of the device we're running on
+void printDeviceProfile(const DeviceProfile &profile);
+
+// Pick a queue family that supports graphics
+std::optional<uint32_t> pickQueueFamily(const std::vector<vk::QueueFamilyProperties> &queueFamilies);
+
+// Pick a queue family with the required flags and none of the excluded ones
+std::optional<uint32_t> pickDedicatedQueueFamily(
+	const std::vector<vk::QueueFamilyProperties> &queueFamilies,
+	vk::QueueFlags required,
+	vk::QueueFlags excluded
+);
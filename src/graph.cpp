@@ -0,0 +1,428 @@
+#include <algorithm>
+#include <numeric>
+#include <tuple>
+
+#include "graph.hpp"
+#include "util.h"
+
+
+// Layout, stages and kind of access a use implies
+struct AccessInfo {
+	vk::ImageLayout layout;
+	vk::PipelineStageFlags stages;
+	vk::AccessFlags access;
+	bool write;
+};
+
+
+static AccessInfo accessInfo(ImageAccess access) {
+	switch (access) {
+	case ImageAccess::ColorAttachment:
+		return {
+			vk::ImageLayout::eColorAttachmentOptimal,
+			vk::PipelineStageFlagBits::eColorAttachmentOutput,
+			vk::AccessFlagBits::eColorAttachmentRead | vk::AccessFlagBits::eColorAttachmentWrite,
+			true
+		};
+	case ImageAccess::DepthAttachment:
+		return {
+			vk::ImageLayout::eDepthStencilAttachmentOptimal,
+			vk::PipelineStageFlagBits::eEarlyFragmentTests | vk::PipelineStageFlagBits::eLateFragmentTests,
+			vk::AccessFlagBits::eDepthStencilAttachmentRead | vk::AccessFlagBits::eDepthStencilAttachmentWrite,
+			true
+		};
+	case ImageAccess::TransferSource:
+		return {
+			vk::ImageLayout::eTransferSrcOptimal,
+			vk::PipelineStageFlagBits::eTransfer,
+			vk::AccessFlagBits::eTransferRead,
+			false
+		};
+	case ImageAccess::TransferDestination:
+		return {
+			vk::ImageLayout::eTransferDstOptimal,
+			vk::PipelineStageFlagBits::eTransfer,
+			vk::AccessFlagBits::eTransferWrite,
+			true
+		};
+	case ImageAccess::Sampled:
+	default:
+		return {
+			vk::ImageLayout::eShaderReadOnlyOptimal,
+			vk::PipelineStageFlagBits::eVertexShader | vk::PipelineStageFlagBits::eFragmentShader,
+			vk::AccessFlagBits::eShaderRead,
+			false
+		};
+	}
+}
+
+
+// Add a barrier for one layer, extending the last barrier if it does the same for the layer before
+static void addLayerBarrier(
+	std::vector<vk::ImageMemoryBarrier> &barriers,
+	vk::Image image,
+	vk::ImageAspectFlags aspects,
+	uint32_t layer,
+	vk::ImageLayout oldLayout,
+	vk::ImageLayout newLayout,
+	vk::AccessFlags srcAccess,
+	vk::AccessFlags dstAccess
+) {
+	if (!barriers.empty()) {
+		auto &last = barriers.back();
+		bool sameTransition = (
+			last.image == image &&
+			last.oldLayout == oldLayout &&
+			last.newLayout == newLayout &&
+			last.srcAccessMask == srcAccess &&
+			last.dstAccessMask == dstAccess
+		);
+		if (sameTransition && last.subresourceRange.baseArrayLayer + last.subresourceRange.layerCount == layer) {
+			last.subresourceRange.layerCount++;
+			return;
+		}
+	}
+	vk::ImageMemoryBarrier barrier{};
+	barrier.srcAccessMask = srcAccess;
+	barrier.dstAccessMask = dstAccess;
+	barrier.oldLayout = oldLayout;
+	barrier.newLayout = newLayout;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.image = image;
+	barrier.subresourceRange = vk::ImageSubresourceRange{aspects, 0, 1, layer, 1};
+	barriers.push_back(barrier);
+}
+
+
+// Declare a use of some layers of an image
+RenderGraph::Pass &RenderGraph::Pass::use(GraphImage image, ImageAccess access, uint32_t baseLayer, uint32_t layerCount) {
+	uses.push_back({image, access, baseLayer, layerCount});
+	return *this;
+}
+
+
+RenderGraph::RenderGraph(VulkanState &vulkan): vulkan(vulkan) {}
+
+
+RenderGraph::~RenderGraph() {
+	vulkan.destroyLater(std::move(storage));
+}
+
+
+// Start declaring a frame
+void RenderGraph::reset() {
+	images.clear();
+	transients.clear();
+	passes.clear();
+}
+
+
+// Add an image owned elsewhere
+GraphImage RenderGraph::importImage(const ImportedImage &image) {
+	LayerState state{image.layout, image.stages, image.writes, {}, {}};
+	images.push_back({image.image, image.aspects, image.layers, {}, {}, std::vector<LayerState>(image.layers, state)});
+	return images.size() - 1;
+}
+
+
+// Keep passes writing an image and leave it in the given layout
+void RenderGraph::markOutput(GraphImage image, vk::ImageLayout finalLayout) {
+	images.at(image).finalLayout = finalLayout;
+}
+
+
+// Add an image owned by the graph
+GraphImage RenderGraph::createImage(const TransientImage &image) {
+	transients.push_back(image);
+	images.push_back({nullptr, image.aspects, image.layers, transients.size() - 1, {}, {}});
+	return images.size() - 1;
+}
+
+
+// Add a pass
+RenderGraph::Pass &RenderGraph::addPass(std::string name, std::function<void(vk::CommandBuffer)> record, bool sideEffects) {
+	passes.push_back({std::move(name), std::move(record), sideEffects});
+	return passes.back();
+}
+
+
+vk::Image RenderGraph::image(GraphImage image) const {
+	return images.at(image).image;
+}
+
+
+vk::ImageView RenderGraph::view(GraphImage image) const {
+	auto &transient = images.at(image).transient;
+	assertThat(transient.has_value(), "Only transient images have views in the graph\n");
+	return *storage.views.at(*transient);
+}
+
+
+// Which passes contribute to an output or have side effects
+std::vector<bool> RenderGraph::livePasses() const {
+	std::vector<bool> needed(images.size());
+	for (size_t i = 0; i < images.size(); i++) {
+		needed[i] = images[i].finalLayout.has_value();
+	}
+
+	// Walk back from the outputs, a pass is live if a later live pass reads what it writes
+	std::vector<bool> live(passes.size());
+	for (size_t i = passes.size(); i-- > 0;) {
+		auto &pass = passes[i];
+		live[i] = pass.sideEffects || std::any_of(pass.uses.begin(), pass.uses.end(), [&](auto &use) {
+			return accessInfo(use.access).write && needed[use.image];
+		});
+		if (!live[i]) {
+			continue;
+		}
+		for (auto &use: pass.uses) {
+			if (!accessInfo(use.access).write) {
+				needed[use.image] = true;
+			}
+		}
+	}
+	return live;
+}
+
+
+// Create images and memory for the transients used by live passes
+void RenderGraph::realizeTransients(const std::vector<bool> &live) {
+	std::vector<Lifetime> lifetimes{};
+	for (auto &info: transients) {
+		lifetimes.push_back({info, SIZE_MAX, 0});
+	}
+	for (size_t i = 0; i < passes.size(); i++) {
+		if (!live[i]) {
+			continue;
+		}
+		for (auto &use: passes[i].uses) {
+			if (auto transient = images.at(use.image).transient) {
+				auto &lifetime = lifetimes.at(*transient);
+				lifetime.first = std::min(lifetime.first, i);
+				lifetime.last = std::max(lifetime.last, i);
+			}
+		}
+	}
+
+	// The same frame as last time, typically everything but the first one after a resize
+	if (lifetimes != realizedLifetimes) {
+		// Frames in flight may still use the old images, and frame buffers made with their views
+		vulkan.destroyLater(std::move(storage));
+		storage = {};
+		vulkan.releaseFramebuffers();
+		realizedLifetimes = lifetimes;
+
+		storage.images.resize(lifetimes.size());
+		storage.views.resize(lifetimes.size());
+		storage.blocks.assign(lifetimes.size(), 0);
+		std::vector<vk::MemoryRequirements> requirements(lifetimes.size());
+		for (size_t i = 0; i < lifetimes.size(); i++) {
+			auto &info = lifetimes[i].info;
+			if (lifetimes[i].first == SIZE_MAX) {
+				continue;
+			}
+			vk::ImageCreateInfo imageInfo{};
+			imageInfo.imageType = vk::ImageType::e2D;
+			imageInfo.format = info.format;
+			imageInfo.extent = vk::Extent3D(info.extent.width, info.extent.height, 1);
+			imageInfo.mipLevels = 1;
+			imageInfo.arrayLayers = info.layers;
+			imageInfo.samples = info.samples;
+			imageInfo.usage = info.usage;
+			storage.images[i] = vulkan.device->createImageUnique(imageInfo);
+			requirements[i] = vulkan.device->getImageMemoryRequirements(*storage.images[i]);
+		}
+
+		// Attachments that never leave the pass, like multisampled ones, can live in lazily allocated
+		// memory, which tilers may never back with real memory at all
+		auto lazyTypes = [&](uint32_t memoryTypeBits) {
+			return vulkan.findMemoryTypes(memoryTypeBits, vk::MemoryPropertyFlagBits::eLazilyAllocated);
+		};
+		std::vector<bool> lazy(lifetimes.size(), false);
+		for (size_t i = 0; i < lifetimes.size(); i++) {
+			bool transientUsage = bool(lifetimes[i].info.usage & vk::ImageUsageFlagBits::eTransientAttachment);
+			lazy[i] = storage.images[i] && transientUsage && !lazyTypes(requirements[i].memoryTypeBits).empty();
+		}
+
+		// Images whose lifetimes don't overlap share a block of memory, as large as the largest of them
+		std::vector<size_t> order(lifetimes.size());
+		std::iota(order.begin(), order.end(), 0);
+		std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+			return lifetimes[a].first < lifetimes[b].first;
+		});
+		std::vector<vk::MemoryRequirements> blockRequirements{};
+		std::vector<size_t> blockLast{};
+		std::vector<bool> blockLazy{};
+		for (size_t i: order) {
+			if (lifetimes[i].first == SIZE_MAX) {
+				continue;
+			}
+			size_t block = 0;
+			for (; block < blockRequirements.size(); block++) {
+				bool free = blockLast[block] < lifetimes[i].first && blockLazy[block] == lazy[i];
+				uint32_t sharedTypes = blockRequirements[block].memoryTypeBits & requirements[i].memoryTypeBits;
+				if (free && sharedTypes && (!lazy[i] || !lazyTypes(sharedTypes).empty())) {
+					break;
+				}
+			}
+			if (block == blockRequirements.size()) {
+				blockRequirements.push_back(requirements[i]);
+				blockLast.push_back(lifetimes[i].last);
+				blockLazy.push_back(lazy[i]);
+			} else {
+				auto &shared = blockRequirements[block];
+				shared.size = std::max(shared.size, requirements[i].size);
+				shared.alignment = std::max(shared.alignment, requirements[i].alignment);
+				shared.memoryTypeBits &= requirements[i].memoryTypeBits;
+				blockLast[block] = lifetimes[i].last;
+			}
+			storage.blocks[i] = block;
+		}
+
+		for (size_t block = 0; block < blockRequirements.size(); block++) {
+			vk::UniqueDeviceMemory memory{};
+			HeapAllocation allocation{};
+			auto properties = blockLazy[block] ?
+				vk::MemoryPropertyFlagBits::eLazilyAllocated :
+				vk::MemoryPropertyFlagBits::eDeviceLocal;
+			std::tie(memory, allocation) = vulkan.allocateMemory(blockRequirements[block], properties);
+			storage.memory.push_back(std::move(memory));
+			storage.allocations.push_back(std::move(allocation));
+		}
+		for (size_t i = 0; i < lifetimes.size(); i++) {
+			if (!storage.images[i]) {
+				continue;
+			}
+			auto &info = lifetimes[i].info;
+			vulkan.device->bindImageMemory(*storage.images[i], *storage.memory.at(storage.blocks[i]), 0);
+			storage.views[i] = vulkan.createImageView(*storage.images[i], info.format, info.aspects, 0, info.layers);
+		}
+	}
+
+	// Earlier users of the same memory, in this frame or one still in flight, must be done with it
+	std::vector<vk::PipelineStageFlags> blockStages(storage.memory.size());
+	std::vector<vk::AccessFlags> blockWrites(storage.memory.size());
+	for (size_t i = 0; i < passes.size(); i++) {
+		if (!live[i]) {
+			continue;
+		}
+		for (auto &use: passes[i].uses) {
+			if (auto transient = images.at(use.image).transient) {
+				auto info = accessInfo(use.access);
+				size_t block = storage.blocks.at(*transient);
+				blockStages.at(block) |= info.stages;
+				if (info.write) {
+					blockWrites.at(block) |= info.access;
+				}
+			}
+		}
+	}
+	for (auto &image: images) {
+		if (!image.transient || !storage.images.at(*image.transient)) {
+			continue;
+		}
+		image.image = *storage.images.at(*image.transient);
+		size_t block = storage.blocks.at(*image.transient);
+		LayerState state{vk::ImageLayout::eUndefined, blockStages.at(block), blockWrites.at(block), {}, {}};
+		image.state.assign(image.layers, state);
+	}
+}
+
+
+// Record the live passes with barriers between them
+void RenderGraph::execute(vk::CommandBuffer commandBuffer) {
+	auto live = livePasses();
+	realizeTransients(live);
+
+	// Barriers for an access to some layers of an image, moving their state along
+	std::vector<vk::ImageMemoryBarrier> barriers{};
+	vk::PipelineStageFlags srcStages{};
+	vk::PipelineStageFlags dstStages{};
+	auto access = [&](Image &image, const AccessInfo &info, uint32_t baseLayer, uint32_t layerCount) {
+		for (uint32_t layer = baseLayer; layer < baseLayer + layerCount; layer++) {
+			LayerState &state = image.state.at(layer);
+			bool transition = state.layout != info.layout;
+			bool needed;
+			vk::PipelineStageFlags waitStages{};
+			if (transition || info.write) {
+				// Layout transitions and writes wait for every earlier access
+				waitStages = state.writeStages | state.readStages;
+				needed = transition || bool(waitStages);
+			} else {
+				// Reads only wait for the last write, unless an earlier read already did in the same way
+				waitStages = state.writeStages;
+				bool waited = (
+					(state.readStages & info.stages) == info.stages &&
+					(state.readAccess & info.access) == info.access
+				);
+				needed = bool(waitStages) && !waited;
+			}
+			if (needed) {
+				srcStages |= waitStages;
+				dstStages |= info.stages;
+				addLayerBarrier(barriers, image.image, image.aspects, layer, state.layout, info.layout, state.writeAccess, info.access);
+			}
+
+			if (transition || info.write) {
+				// A transition is a write too, so later reads wait for it
+				state = {info.layout, info.stages, info.write ? info.access : vk::AccessFlags{}, {}, {}};
+				if (!info.write) {
+					state.readStages = info.stages;
+					state.readAccess = info.access;
+				}
+			} else {
+				state.readStages |= info.stages;
+				state.readAccess |= info.access;
+			}
+		}
+	};
+	auto flushBarriers = [&]() {
+		if (barriers.empty()) {
+			return;
+		}
+		commandBuffer.pipelineBarrier(
+			srcStages ? srcStages : vk::PipelineStageFlags{vk::PipelineStageFlagBits::eTopOfPipe},
+			dstStages,
+			{}, nullptr, nullptr, barriers
+		);
+		vulkan.stats.current.barriers += barriers.size();
+		barriers.clear();
+		srcStages = {};
+		dstStages = {};
+	};
+
+	for (size_t i = 0; i < passes.size(); i++) {
+		auto &pass = passes[i];
+		if (!live[i]) {
+			vulkan.stats.current.culledPasses++;
+			continue;
+		}
+		for (auto &use: pass.uses) {
+			auto &image = images.at(use.image);
+			uint32_t layerCount = use.layerCount == GRAPH_ALL_LAYERS ? image.layers - use.baseLayer : use.layerCount;
+			access(image, accessInfo(use.access), use.baseLayer, layerCount);
+		}
+		flushBarriers();
+		pass.record(commandBuffer);
+		vulkan.stats.current.passes++;
+	}
+
+	// Outputs are left in the layout their next user expects, which synchronizes by itself
+	for (auto &image: images) {
+		if (!image.finalLayout) {
+			continue;
+		}
+		for (uint32_t layer = 0; layer < image.layers; layer++) {
+			LayerState &state = image.state.at(layer);
+			if (state.layout == *image.finalLayout) {
+				continue;
+			}
+			srcStages |= state.writeStages | state.readStages;
+			dstStages |= vk::PipelineStageFlagBits::eBottomOfPipe;
+			addLayerBarrier(barriers, image.image, image.aspects, layer, state.layout, *image.finalLayout, state.writeAccess, {});
+			state.layout = *image.finalLayout;
+		}
+	}
+	flushBarriers();
+}
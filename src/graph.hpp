@@ -0,0 +1,176 @@
+#pragma once
+
+// Render graph of a frame
+// Passes declare which images they use and how, and are recorded in the order they were added.
+// The graph culls passes whose results nothing uses, puts the barriers between passes, and places
+// transient images whose lifetimes don't overlap in the same memory.
+
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "vulkan.hpp"
+
+
+// Image of the graph, only valid for the frame it was declared in
+using GraphImage = uint32_t;
+
+// All layers of an image
+static const uint32_t GRAPH_ALL_LAYERS = UINT32_MAX;
+
+
+// How a pass uses an image, each implies a layout, the stages and the kind of access
+enum class ImageAccess {
+	// Written by rendering, cleared first
+	ColorAttachment,
+	DepthAttachment,
+	// Read or written by copies and blits
+	TransferSource,
+	TransferDestination,
+	// Sampled by shaders
+	Sampled,
+};
+
+
+// Image owned outside the graph, and how it was last used before the frame
+struct ImportedImage {
+	vk::Image image;
+	vk::ImageAspectFlags aspects;
+	uint32_t layers = 1;
+	// Layout at the start of the frame, undefined if the contents don't matter
+	vk::ImageLayout layout = vk::ImageLayout::eUndefined;
+	// Stages and writes of earlier commands the first pass using it waits for,
+	// like those of the previous frame when the image is shared by frames in flight
+	vk::PipelineStageFlags stages{};
+	vk::AccessFlags writes{};
+};
+
+
+// Image that only lives through the passes using it, its contents start out undefined
+struct TransientImage {
+	vk::Format format;
+	vk::Extent2D extent;
+	vk::ImageUsageFlags usage;
+	vk::ImageAspectFlags aspects;
+	uint32_t layers = 1;
+	vk::SampleCountFlagBits samples = vk::SampleCountFlagBits::e1;
+
+	bool operator==(const TransientImage &other) const {
+		return (
+			format == other.format &&
+			extent == other.extent &&
+			usage == other.usage &&
+			aspects == other.aspects &&
+			layers == other.layers &&
+			samples == other.samples
+		);
+	}
+};
+
+
+class RenderGraph
+{
+public:
+	// Pass with the images it uses, see addPass
+	struct Pass {
+		struct Use {
+			GraphImage image;
+			ImageAccess access;
+			uint32_t baseLayer;
+			uint32_t layerCount;
+		};
+
+		std::string name;
+		std::function<void(vk::CommandBuffer)> record;
+		bool sideEffects;
+		std::vector<Use> uses{};
+
+		// Declare a use of some layers of an image
+		Pass &use(GraphImage image, ImageAccess access, uint32_t baseLayer = 0, uint32_t layerCount = GRAPH_ALL_LAYERS);
+	};
+
+	explicit RenderGraph(VulkanState &vulkan);
+	~RenderGraph();
+
+	// Start declaring a frame, dropping the passes and images of the last one
+	void reset();
+
+	// Add an image owned elsewhere
+	GraphImage importImage(const ImportedImage &image);
+
+	// Keep passes writing an image even if no other pass reads it, and leave it in the given layout
+	void markOutput(GraphImage image, vk::ImageLayout finalLayout);
+
+	// Add an image owned by the graph, realized when the frame is executed
+	GraphImage createImage(const TransientImage &image);
+
+	// Add a pass, the returned reference is valid until the next pass is added
+	// Passes with side effects, like copies read back by the host, are never culled
+	Pass &addPass(std::string name, std::function<void(vk::CommandBuffer)> record, bool sideEffects = false);
+
+	// Handles of a transient image, only valid while recording passes that use it
+	vk::Image image(GraphImage image) const;
+	vk::ImageView view(GraphImage image) const;
+
+	// Cull unused passes, realize transient images and record the remaining passes with barriers
+	void execute(vk::CommandBuffer commandBuffer);
+
+private:
+	// What earlier accesses of a layer the next one may have to wait for
+	struct LayerState {
+		vk::ImageLayout layout;
+		vk::PipelineStageFlags writeStages;
+		vk::AccessFlags writeAccess;
+		// Reads that already waited for the last write
+		vk::PipelineStageFlags readStages;
+		vk::AccessFlags readAccess;
+	};
+
+	struct Image {
+		vk::Image image;
+		vk::ImageAspectFlags aspects;
+		uint32_t layers;
+		// Index in transients, or empty if imported
+		std::optional<size_t> transient;
+		std::optional<vk::ImageLayout> finalLayout;
+		std::vector<LayerState> state;
+	};
+
+	// Transient image as realized, kept while the frames declare the same ones
+	struct Lifetime {
+		TransientImage info;
+		// First and last live pass using it
+		size_t first;
+		size_t last;
+
+		bool operator==(const Lifetime &other) const {
+			return info == other.info && first == other.first && last == other.last;
+		}
+	};
+
+	// Memory of the transient images, replaced all together
+	struct TransientStorage {
+		std::vector<vk::UniqueDeviceMemory> memory{};
+		std::vector<HeapAllocation> allocations{};
+		std::vector<vk::UniqueImage> images{};
+		std::vector<vk::UniqueImageView> views{};
+		// Memory block of each image
+		std::vector<size_t> blocks{};
+	};
+
+	VulkanState &vulkan;
+	std::vector<Image> images{};
+	std::vector<TransientImage> transients{};
+	std::vector<Pass> passes{};
+
+	std::vector<Lifetime> realizedLifetimes{};
+	TransientStorage storage{};
+
+	// Which passes contribute to an output or have side effects
+	std::vector<bool> livePasses() const;
+
+	// Create images and memory for the transients used by live passes, reusing the last ones if unchanged
+	void realizeTransients(const std::vector<bool> &live);
+};
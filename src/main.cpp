@@ -1,22 +1,40 @@
+#include <algorithm>
 #include <cmath>
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <filesystem>
+#include <optional>
+#include <string>
 
 #define GLFW_INCLUDE_VULKAN
 #include <GLFW/glfw3.h>
 // not necessary since glm 0.9.6 but include for compatibility
 #define GLM_FORCE_RADIANS
 #include <glm/glm.hpp>
+#include <glm/gtc/constants.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
+#include "capture.hpp"
+#include "graph.hpp"
+#include "meshfile.hpp"
 #include "model.hpp"
+#include "overlay.hpp"
 #include "particles.hpp"
+#include "resolution.hpp"
+#include "ring.hpp"
 #include "terrain.hpp"
 #include "util.h"
+#include "variants.hpp"
 #include "vulkan.hpp"
 
 namespace fs = std::filesystem;
 
+// Most views rendered side by side, sizes the per frame view matrix buffer
+static const uint32_t MAX_VIEWS = 8;
+// Push constant offset of the view buffer index read by the multiview shaders
+static const uint32_t VIEW_BUFFER_PUSH_OFFSET = 96;
+
 static void glfwErrorCallback(int error, const char *description) {
 	fprintf(stderr, "GLFW error: %s\n", description);
 }
@@ -42,6 +60,41 @@ static std::vector<uint8_t> readFile(fs::path filename) {
 };
 
 
+// Check whether a flag was passed on the command line
+static bool hasFlag(int argc, char **argv, const char *flag) {
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], flag) == 0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+
+// Get the value following a flag on the command line, or a default if not given
+static const char *flagValue(int argc, char **argv, const char *flag, const char *defaultValue) {
+	for (int i = 1; i < argc - 1; i++) {
+		if (strcmp(argv[i], flag) == 0) {
+			return argv[i + 1];
+		}
+	}
+	return defaultValue;
+}
+
+
+// Add attributes for a mat4 model transform, which takes a location per column
+static void addTransformAttributes(std::vector<vk::VertexInputAttributeDescription> &attributes, uint32_t binding, uint32_t firstLocation) {
+	for (uint32_t column = 0; column < 4; column++) {
+		attributes.push_back({
+			firstLocation + column,
+			binding,
+			vk::Format::eR32G32B32A32Sfloat,
+			(uint32_t) (column * sizeof(glm::vec4))
+		});
+	}
+}
+
+
 int main(int argc, char** argv) {
 	if (!glfwInit()) {
 		fprintf(stderr, "Could not initialize GLFW\n");
@@ -49,8 +102,70 @@ int main(int argc, char** argv) {
 	}
 	glfwSetErrorCallback(glfwErrorCallback);
 
+	// Lay down terrain depth first so the terrain is only shaded once per pixel
+	bool depthPrePass = !hasFlag(argc, argv, "--no-depth-prepass");
+	// Lower the render resolution when the GPU can't keep up with the frame time budget
+	bool dynamicResolution = !hasFlag(argc, argv, "--no-dynamic-resolution");
+	DynamicResolution resolution{(float) atof(flagValue(argc, argv, "--frame-budget", "16.6"))};
+
+	// Pick a specific GPU instead of the best scoring one
+	const char *deviceOverride = flagValue(argc, argv, "--device", getenv("VULKAN_DEMO_DEVICE"));
+
+	// Record passes into render pass and frame buffer objects even if dynamic rendering is supported
+	bool allowDynamicRendering = !hasFlag(argc, argv, "--no-dynamic-rendering");
+
 	VulkanState vulkan{};
-	vulkan.init();
+	vulkan.init(deviceOverride, allowDynamicRendering);
+
+	// Fractions of each heap's budget to stay under, streamed resources are evicted past them
+	// Limits of zero, above one, or a soft limit over the hard one would evict and reload every frame,
+	// and non-finite ones would fail every comparison
+	float softLimit = atof(flagValue(argc, argv, "--memory-soft-limit", "0.8"));
+	float hardLimit = atof(flagValue(argc, argv, "--memory-hard-limit", "0.95"));
+	if (!(softLimit > 0.0f && softLimit <= 1.0f && hardLimit > 0.0f && hardLimit <= 1.0f && softLimit <= hardLimit)) {
+		// Clamping would keep NaN, so those fall back to the defaults
+		hardLimit = std::isfinite(hardLimit) ? std::clamp(hardLimit, 0.01f, 1.0f) : 0.95f;
+		softLimit = std::isfinite(softLimit) ? softLimit : 0.8f;
+		softLimit = std::clamp(softLimit, 0.01f, hardLimit);
+		fprintf(stderr, "Memory limits must be in (0, 1] with soft <= hard, using %.2f and %.2f\n", softLimit, hardLimit);
+	}
+	vulkan.memoryBudget.softLimit = softLimit;
+	vulkan.memoryBudget.hardLimit = hardLimit;
+
+	// Refine height map terrain on the GPU by screen space edge length, needs tessellation shaders
+	bool tessellatedTerrain = hasFlag(argc, argv, "--tessellated-terrain");
+	if (tessellatedTerrain && !(vulkan.deviceProfile.tessellation && vulkan.bindless)) {
+		fprintf(stderr, "Tessellated terrain needs tessellation shaders and descriptor indexing, drawing the terrain mesh instead\n");
+		tessellatedTerrain = false;
+	}
+	// Draw the terrain from a height map image instead of vertex buffers, needs bindless descriptors
+	bool heightmapTerrain = tessellatedTerrain || hasFlag(argc, argv, "--heightmap-terrain");
+	if (heightmapTerrain && !vulkan.bindless) {
+		fprintf(stderr, "Height map terrain needs descriptor indexing, drawing the terrain mesh instead\n");
+		heightmapTerrain = false;
+	}
+
+	// Render several cameras side by side, all in one multiview pass unless separate passes are asked for
+	uint32_t viewCount = std::clamp(atoi(flagValue(argc, argv, "--views", "1")), 1, (int) MAX_VIEWS);
+	bool multiview = viewCount > 1 && !hasFlag(argc, argv, "--sequential-views");
+	if (multiview && !(vulkan.deviceProfile.multiview && vulkan.bindless)) {
+		fprintf(stderr, "Multiview needs device support and descriptor indexing, rendering views in separate passes\n");
+		multiview = false;
+	} else if (multiview && tessellatedTerrain) {
+		fprintf(stderr, "Tessellated terrain doesn't support multiview, rendering views in separate passes\n");
+		multiview = false;
+	}
+	if (multiview) {
+		viewCount = std::min(viewCount, vulkan.deviceProfile.maxViews);
+	}
+	vulkan.setViews(viewCount, multiview);
+
+	// Multisampled color and depth are resolved at the end of each pass
+	uint32_t requestedSamples = std::max(atoi(flagValue(argc, argv, "--msaa", "1")), 1);
+	uint32_t samples = vulkan.setSamples(requestedSamples);
+	if (samples < requestedSamples) {
+		fprintf(stderr, "%ux MSAA isn't supported, using %ux\n", requestedSamples, samples);
+	}
 
 	glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
 	GLFWwindow *window = glfwCreateWindow(800, 600, "Vulkan demo", NULL, NULL);
@@ -60,42 +175,134 @@ int main(int argc, char** argv) {
 	VkSurfaceKHR surface;
 	assertVkSuccess(glfwCreateWindowSurface(*vulkan.instance, window, NULL, &surface));
 
-	vulkan.setSurface(surface);
-
 	fs::path basePath{argv[0]};
 	basePath = basePath.parent_path();
 
-	vk::VertexInputBindingDescription vertexBinding{};
-	vertexBinding.binding = 0;
-	vertexBinding.stride = sizeof(Vertex);
-	vertexBinding.inputRate = vk::VertexInputRate::eVertex;
+	// Vertex shaders have multiview variants that read the view matrix of gl_ViewIndex
+	auto readVertexShader = [&](std::string name) {
+		return readFile(basePath / (name + (multiview ? "_multiview" : "") + ".vert.spv"));
+	};
+
+	// Samples along each side of the height map
+	const char *terrainSizeFlag = flagValue(argc, argv, "--terrain-size", nullptr);
+	size_t terrainSize = terrainSizeFlag ? std::clamp(atoi(terrainSizeFlag), 2, 4096) : MAP_SIZE;
+
+	// Model transform per instance, read from the instance ring
+	vk::VertexInputBindingDescription instanceBinding{};
+	instanceBinding.binding = 1;
+	instanceBinding.stride = sizeof(glm::mat4);
+	instanceBinding.inputRate = vk::VertexInputRate::eInstance;
+
+	std::array<vk::VertexInputBindingDescription, 2> vertexBindings{};
+	vertexBindings[0].binding = 0;
+	vertexBindings[0].stride = sizeof(Vertex);
+	vertexBindings[0].inputRate = vk::VertexInputRate::eVertex;
+	vertexBindings[1] = instanceBinding;
 	std::vector<vk::VertexInputAttributeDescription> vertexAttributes{
 		{0, 0, vk::Format::eR32G32B32Sfloat, offsetof(Vertex, pos)},
 		{1, 0, vk::Format::eR32G32B32Sfloat, offsetof(Vertex, normal)},
 		{2, 0, vk::Format::eR32G32Sfloat, offsetof(Vertex, texCoord)},
 	};
+	addTransformAttributes(vertexAttributes, 1, 3);
 
 	vk::PipelineVertexInputStateCreateInfo vertexInputInfo{};
-	vertexInputInfo.vertexBindingDescriptionCount = 1;
-	vertexInputInfo.pVertexBindingDescriptions = &vertexBinding;
+	vertexInputInfo.vertexBindingDescriptionCount = vertexBindings.size();
+	vertexInputInfo.pVertexBindingDescriptions = vertexBindings.data();
 	vertexInputInfo.vertexAttributeDescriptionCount = vertexAttributes.size();
 	vertexInputInfo.pVertexAttributeDescriptions = vertexAttributes.data();
 	
-	auto terrainPipeline = vulkan.makePipeline(
-		readFile(basePath / "terrain.vert.spv"),
-		readFile(basePath / "terrain.frag.spv"),
-		vertexInputInfo,
-		vk::PrimitiveTopology::eTriangleList,
-		sizeof(glm::mat4)
-	);
+	// Height map terrain pulls its vertices in the shader, only the instance transforms are inputs
+	std::vector<vk::VertexInputAttributeDescription> heightmapAttributes{};
+	addTransformAttributes(heightmapAttributes, 1, 0);
+
+	vk::PipelineVertexInputStateCreateInfo heightmapInputInfo{};
+	heightmapInputInfo.vertexBindingDescriptionCount = 1;
+	heightmapInputInfo.pVertexBindingDescriptions = &instanceBinding;
+	heightmapInputInfo.vertexAttributeDescriptionCount = heightmapAttributes.size();
+	heightmapInputInfo.pVertexAttributeDescriptions = heightmapAttributes.data();
+
+	size_t terrainPushConstantSize = sizeof(glm::mat4) + (heightmapTerrain ? sizeof(HeightmapPushConstants) : 0);
+
+	// Terrain geometry stages, shared by the depth pre-pass for height map terrain
+	std::vector<ShaderStage> terrainStages{};
+	vk::PrimitiveTopology terrainTopology = vk::PrimitiveTopology::eTriangleList;
+	if (tessellatedTerrain) {
+		terrainStages = {
+			{vk::ShaderStageFlagBits::eVertex, readFile(basePath / "terrain_patch.vert.spv")},
+			{vk::ShaderStageFlagBits::eTessellationControl, readFile(basePath / "terrain.tesc.spv")},
+			{vk::ShaderStageFlagBits::eTessellationEvaluation, readFile(basePath / "terrain.tese.spv")},
+		};
+		terrainTopology = vk::PrimitiveTopology::ePatchList;
+	} else if (heightmapTerrain) {
+		terrainStages = {{vk::ShaderStageFlagBits::eVertex, readVertexShader("terrain_heightmap")}};
+	} else {
+		terrainStages = {{vk::ShaderStageFlagBits::eVertex, readVertexShader("terrain")}};
+	}
+	auto terrainFragmentCode = readFile(basePath / "terrain.frag.spv");
+
+	// Pipelines are specialized with their tunables and made once per combination of values
+	VariantCache pipelines{vulkan};
+
+	// Terrain colours are specialization constants, the C key cycles through the palettes
+	size_t paletteIndex = 0;
+	auto getTerrainPipeline = [&](const TerrainPalette &palette) -> const Pipeline& {
+		auto stages = terrainStages;
+		stages.push_back({vk::ShaderStageFlagBits::eFragment, terrainFragmentCode, palette.constants()});
+		return pipelines.get(
+			stages,
+			heightmapTerrain ? heightmapInputInfo : vertexInputInfo,
+			terrainTopology,
+			terrainPushConstantSize,
+			depthPrePass ? DepthMode::Equal : DepthMode::ReadWrite,
+			TERRAIN_PATCH_CORNERS
+		);
+	};
+	const Pipeline *terrainPipeline = &getTerrainPipeline(TERRAIN_PALETTES.at(paletteIndex));
+
+	// Depth pre-pass only reads the packed position stream
+	std::array<vk::VertexInputBindingDescription, 2> positionBindings{};
+	positionBindings[0].binding = 0;
+	positionBindings[0].stride = sizeof(glm::vec3);
+	positionBindings[0].inputRate = vk::VertexInputRate::eVertex;
+	positionBindings[1] = instanceBinding;
+	std::vector<vk::VertexInputAttributeDescription> positionAttributes{
+		{0, 0, vk::Format::eR32G32B32Sfloat, 0},
+	};
+	addTransformAttributes(positionAttributes, 1, 1);
+
+	vk::PipelineVertexInputStateCreateInfo positionInputInfo{};
+	positionInputInfo.vertexBindingDescriptionCount = positionBindings.size();
+	positionInputInfo.pVertexBindingDescriptions = positionBindings.data();
+	positionInputInfo.vertexAttributeDescriptionCount = positionAttributes.size();
+	positionInputInfo.pVertexAttributeDescriptions = positionAttributes.data();
+
+	const Pipeline *terrainDepthPipeline = nullptr;
+	if (depthPrePass && heightmapTerrain) {
+		// Height map shaders are cheap enough to run as is, without their outputs
+		terrainDepthPipeline = &pipelines.get(
+			terrainStages,
+			heightmapInputInfo,
+			terrainTopology,
+			terrainPushConstantSize,
+			DepthMode::ReadWrite,
+			TERRAIN_PATCH_CORNERS
+		);
+	} else if (depthPrePass) {
+		terrainDepthPipeline = &pipelines.get(
+			{{vk::ShaderStageFlagBits::eVertex, readVertexShader("terrain_depth")}},
+			positionInputInfo,
+			vk::PrimitiveTopology::eTriangleList,
+			sizeof(glm::mat4)
+		);
+	}
 
+	// Particles are drawn from the positions written by the simulation
 	vk::VertexInputBindingDescription particleVertexBinding{};
 	particleVertexBinding.binding = 0;
-	particleVertexBinding.stride = sizeof(Particle);
+	particleVertexBinding.stride = sizeof(glm::vec4);
 	particleVertexBinding.inputRate = vk::VertexInputRate::eVertex;
 	std::vector<vk::VertexInputAttributeDescription> particleVertexAttributes{
-		{0, 0, vk::Format::eR32G32B32Sfloat, offsetof(Particle, pos0)},
-		{1, 0, vk::Format::eR32G32B32Sfloat, offsetof(Particle, v0)},
+		{0, 0, vk::Format::eR32G32B32A32Sfloat, 0},
 	};
 
 	vk::PipelineVertexInputStateCreateInfo particleVertexInputInfo{};
@@ -104,18 +311,96 @@ int main(int argc, char** argv) {
 	particleVertexInputInfo.vertexAttributeDescriptionCount = particleVertexAttributes.size();
 	particleVertexInputInfo.pVertexAttributeDescriptions = particleVertexAttributes.data();
 
-	auto particlePipeline = vulkan.makePipeline(
-		readFile(basePath / "particle.vert.spv"),
-		readFile(basePath / "particle.frag.spv"),
+	// Particle size in pixels and gravity are specialization constants too
+	float particleSize = atof(flagValue(argc, argv, "--particle-size", "10"));
+	float gravity = atof(flagValue(argc, argv, "--gravity", "1"));
+
+	// Particles discard fragments outside their circle, so don't write depth to keep early depth testing
+	const Pipeline &particlePipeline = pipelines.get(
+		{
+			{
+				vk::ShaderStageFlagBits::eVertex,
+				readVertexShader("particle"),
+				SpecializationConstants{}.set(PARTICLE_POINT_SIZE, particleSize),
+			},
+			{vk::ShaderStageFlagBits::eFragment, readFile(basePath / "particle.frag.spv")},
+		},
 		particleVertexInputInfo,
 		vk::PrimitiveTopology::ePointList,
-		sizeof(std::pair<glm::mat4, float>)
+		sizeof(glm::mat4),
+		DepthMode::ReadOnly
 	);
 
-	Model terrainModel = makeTerrainModel();
-	UploadedModel terrainBuffers = UploadedModel::fromModel(terrainModel, vulkan);
+	// Pipelines only depend on the views and render target formats, so the swap chain is made after them
+	vulkan.setSurface(surface);
+
+	// Load the terrain from a mesh cache in the background if there is one,
+	// otherwise generate it and write the cache for the next start
+	auto terrainCachePath = basePath / "terrain.mesh";
+	std::optional<UploadedModel> terrainBuffers{};
+	// Height map kept on the CPU for editing, edits are copied to the uploaded model or image each frame
+	// Made on first use, so terrain loaded from the mesh cache is only generated again if it is edited
+	std::optional<Terrain> terrain{};
+	auto editableTerrain = [&]() -> Terrain& {
+		if (!terrain) {
+			terrain.emplace(terrainSize, heightmapTerrain);
+		}
+		return *terrain;
+	};
+	std::optional<HeightmapTexture> heightmap{};
+	// Terrain buffers can be evicted when memory runs low, and are brought back once there is room
+	std::optional<EvictionHandle> terrainEviction{};
+	// Heap and size of the terrain buffers while they are evicted
+	std::optional<std::pair<uint32_t, vk::DeviceSize>> evictedTerrain{};
+	// Swap in new terrain buffers, frames in flight may still be drawing the old ones
+	auto replaceTerrain = [&](UploadedModel model) {
+		if (terrainEviction) {
+			vulkan.memoryBudget.remove(*terrainEviction);
+		}
+		if (terrainBuffers) {
+			vulkan.destroyLater(std::move(*terrainBuffers));
+		}
+		terrainBuffers = std::move(model);
+		evictedTerrain.reset();
+
+		uint32_t heap = terrainBuffers->vertices.allocation.heapIndex();
+		vk::DeviceSize size = (
+			terrainBuffers->vertices.allocation.bytes() +
+			terrainBuffers->positions.allocation.bytes() +
+			terrainBuffers->indices.allocation.bytes()
+		);
+		terrainEviction = vulkan.memoryBudget.add(heap, size, [&, heap, size]() {
+			vulkan.destroyLater(std::move(*terrainBuffers));
+			terrainBuffers.reset();
+			terrainEviction.reset();
+			evictedTerrain = {heap, size};
+		});
+	};
+	MeshLoader meshLoader{vulkan};
+	auto generateTerrain = [&]() {
+		Model terrainModel = editableTerrain().model();
+		replaceTerrain(UploadedModel::fromModel(terrainModel, vulkan));
+		// Cache only holds the default size
+		if (terrainSize == MAP_SIZE && !writeMeshFile(terrainCachePath, terrainModel)) {
+			fprintf(stderr, "Could not write terrain mesh cache\n");
+		}
+	};
+	if (heightmapTerrain) {
+		heightmap = HeightmapTexture::create(vulkan, terrainSize, tessellatedTerrain);
+		// Whole height map goes through the staging ring in the first frames
+		editableTerrain().invalidate();
+	} else if (terrainSize == MAP_SIZE && fs::exists(terrainCachePath) && !hasFlag(argc, argv, "--regenerate-terrain")) {
+		meshLoader.request(terrainCachePath);
+	} else {
+		generateTerrain();
+	}
 
-	auto [particles, particleCount] = makeParticles(vulkan);
+	ParticleSystem particles{vulkan, readFile(basePath / "particle.comp.spv"), gravity};
+
+	// Statistics drawn over the scene, the S key toggles them
+	StatsOverlay overlay{vulkan, readFile(basePath / "overlay.vert.spv"), readFile(basePath / "overlay.frag.spv")};
+	bool showStats = hasFlag(argc, argv, "--stats");
+	bool statsKeyWasDown = false;
 
 	// TODO: should use a real projection, this is a bit of a hack...
 	glm::mat4 projection{1};
@@ -135,11 +420,94 @@ int main(int argc, char** argv) {
 	clearValues[1].depthStencil.depth = 1.0;
 	clearValues[1].depthStencil.stencil = 0;
 
+	// Passes of each frame, with the barriers between them and their transient depth buffers
+	RenderGraph frameGraph{vulkan};
+
+	// Write rendered frames to disk, optionally stopping after a number of frames
+	std::optional<FrameCapture> capture{};
+	const char *captureDirectory = flagValue(argc, argv, "--capture", nullptr);
+	size_t captureCount = atoi(flagValue(argc, argv, "--capture-count", "0"));
+	if (captureDirectory != nullptr) {
+		capture.emplace(vulkan, captureDirectory);
+	}
+
+	// Terrain is drawn as a grid of tiles in a single instanced draw
+	int terrainTiles = std::clamp(atoi(flagValue(argc, argv, "--terrain-tiles", "1")), 1, 128);
+	std::vector<glm::mat4> terrainTransforms{};
+	for (int z = 0; z < terrainTiles; z++) {
+		for (int x = 0; x < terrainTiles; x++) {
+			glm::vec3 offset{x - (terrainTiles - 1) / 2.0f, 0.0f, z - (terrainTiles - 1) / 2.0f};
+			terrainTransforms.push_back(glm::translate(glm::mat4{1}, offset));
+		}
+	}
+
+	// Per instance data is written each frame, room for a full 128x128 grid of transforms
+	MappedRing instanceRing{vulkan, vk::BufferUsageFlagBits::eVertexBuffer, 128 * 128 * sizeof(glm::mat4)};
+
+	// Continuously dig and raise the terrain, staging edited vertices through a ring
+	bool deformTerrain = hasFlag(argc, argv, "--deform-terrain");
+	MappedRing terrainStaging{vulkan, vk::BufferUsageFlagBits::eTransferSrc, 4 * 1024 * 1024};
+
+	// View projection of every view for the multiview shaders, each frame's region is a bindless buffer
+	MappedRing viewRing{vulkan, vk::BufferUsageFlagBits::eStorageBuffer, MAX_VIEWS * sizeof(glm::mat4)};
+	std::array<uint32_t, MAX_FRAMES_IN_FLIGHT> viewBuffers{};
+	if (multiview) {
+		for (size_t frame = 0; frame < MAX_FRAMES_IN_FLIGHT; frame++) {
+			viewBuffers[frame] = vulkan.bindless->addBuffer(viewRing.buffer(), viewRing.frameOffset(frame), MAX_VIEWS * sizeof(glm::mat4));
+		}
+	}
+
+	// Run a number of frames and report average times, to compare multiview with separate passes
+	size_t benchmarkFrames = atoi(flagValue(argc, argv, "--benchmark-frames", "0"));
+	size_t framesRendered = 0;
+	double recordTimeTotal = 0.0;
+	double gpuTimeTotal = 0.0;
+	size_t gpuTimeFrames = 0;
+
 	double startTime = glfwGetTime();
+	bool paletteKeyWasDown = false;
 
 
 	while (!glfwWindowShouldClose(window)) {
 
+		for (auto &[path, model]: meshLoader.poll()) {
+			if (model) {
+				replaceTerrain(std::move(*model));
+				// Cached model doesn't have edits made while it was loading
+				if (terrain) {
+					terrain->invalidate();
+				}
+			} else {
+				// Cache is unreadable, from an older format, or there was no memory for it on the
+				// loader thread. Made here instead, where allocations can wait for released memory.
+				generateTerrain();
+			}
+		}
+
+		// Bring evicted terrain back once its heap has room for it again
+		if (evictedTerrain && vulkan.memoryBudget.hasHeadroom(evictedTerrain->first, evictedTerrain->second)) {
+			evictedTerrain.reset();
+			if (terrainSize == MAP_SIZE && fs::exists(terrainCachePath)) {
+				meshLoader.request(terrainCachePath);
+			} else {
+				generateTerrain();
+			}
+		}
+
+		// Switch palettes on key press, variants made before are reused
+		bool paletteKeyDown = glfwGetKey(window, GLFW_KEY_C) == GLFW_PRESS;
+		if (paletteKeyDown && !paletteKeyWasDown) {
+			paletteIndex = (paletteIndex + 1) % TERRAIN_PALETTES.size();
+			terrainPipeline = &getTerrainPipeline(TERRAIN_PALETTES.at(paletteIndex));
+		}
+		paletteKeyWasDown = paletteKeyDown;
+
+		bool statsKeyDown = glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS;
+		if (statsKeyDown && !statsKeyWasDown) {
+			showStats = !showStats;
+		}
+		statsKeyWasDown = statsKeyDown;
+
 		auto maybeImage = vulkan.acquireImage();
 		if (!maybeImage.has_value()) {
 			// If the swap chain needs recreating we wait until the next frame
@@ -147,75 +515,272 @@ int main(int argc, char** argv) {
 		}
 		auto [framebufferIndex, perFrame] = *maybeImage;
 
-		// Simple view rotating by time
-		double time = glfwGetTime() - startTime;
-		glm::mat4 view = glm::lookAt(
-			glm::vec3(2 * cos(time), -2.0, 2 * sin(time)),
-			glm::vec3(0.0, 0.2, 0.0),
-			glm::vec3(0.0, 1.0, 0.0)
-		);
-		glm::mat4 mvp = projection * view;
-		auto particleState = std::make_pair(mvp, (float) fmod(time, 3.0));
+		instanceRing.beginFrame(vulkan.currentFrame);
+		terrainStaging.beginFrame(vulkan.currentFrame);
 
-		vk::DeviceSize zeroOffset = 0;
-
-		vk::CommandBufferBeginInfo commandBufferInfo{};
-		commandBufferInfo.flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit;
-		perFrame.commandBuffer.begin(commandBufferInfo);
+		if (capture) {
+			// Frame fence has been waited for, so earlier captures from this frame are done
+			capture->collect(vulkan.currentFrame);
+		}
 
-		vk::RenderPassBeginInfo renderPassInfo{};
-		renderPassInfo.renderPass = *vulkan.renderpass;
-		renderPassInfo.framebuffer = *vulkan.framebuffers.at(framebufferIndex);
-		renderPassInfo.renderArea.offset = {{0, 0}};
-		renderPassInfo.renderArea.extent = vulkan.currentExtent;
-		renderPassInfo.clearValueCount = clearValues.size();
-		renderPassInfo.pClearValues = clearValues.data();
-		perFrame.commandBuffer.beginRenderPass(renderPassInfo, vk::SubpassContents::eInline);
+		if (dynamicResolution) {
+			vulkan.setRenderScale(resolution.update(vulkan.gpuFrameTime));
+		}
 
-		// Draw terrain
+		if (vulkan.gpuFrameTime > 0.0) {
+			gpuTimeTotal += vulkan.gpuFrameTime;
+			gpuTimeFrames++;
+		}
 
-		perFrame.commandBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics, *terrainPipeline.pipeline);
+		// Simple views rotating by time, spread evenly around the terrain
+		double time = glfwGetTime() - startTime;
+		std::vector<glm::mat4> viewProjections{};
+		for (uint32_t i = 0; i < vulkan.viewCount; i++) {
+			double angle = time + i * glm::two_pi<double>() / vulkan.viewCount;
+			glm::mat4 view = glm::lookAt(
+				glm::vec3(2 * cos(angle), -2.0, 2 * sin(angle)),
+				glm::vec3(0.0, 0.2, 0.0),
+				glm::vec3(0.0, 1.0, 0.0)
+			);
+			viewProjections.push_back(projection * view);
+		}
+		viewRing.beginFrame(vulkan.currentFrame);
+		if (multiview) {
+			// Only thing in the ring, so it starts at the frame's bindless buffer
+			viewRing.push(viewProjections.data(), viewProjections.size() * sizeof(glm::mat4), sizeof(glm::mat4));
+		}
 
-		perFrame.commandBuffer.setViewport(0, vulkan.viewport);
-		perFrame.commandBuffer.setScissor(0, vulkan.scissor);
+		if (deformTerrain) {
+			// Brush circles the terrain, alternating between raising and lowering
+			glm::vec2 brushCenter{0.3 * cos(time * 0.7), 0.3 * sin(time * 0.7)};
+			editableTerrain().brush(brushCenter, 0.1, 0.02 * sin(time * 2));
+		}
 
-		perFrame.commandBuffer.pushConstants(
-			*terrainPipeline.layout,
-			vk::ShaderStageFlagBits::eVertex,
-			0,
-			sizeof(mvp),
-			&mvp
+		auto terrainInstanceOffset = instanceRing.push(
+			terrainTransforms.data(),
+			terrainTransforms.size() * sizeof(terrainTransforms[0]),
+			sizeof(terrainTransforms[0])
 		);
 
-		perFrame.commandBuffer.bindVertexBuffers(0, *(terrainBuffers.vertices.buffer), zeroOffset);
-		perFrame.commandBuffer.bindIndexBuffer(*(terrainBuffers.indices.buffer), zeroOffset, vk::IndexType::eUint32);
-		perFrame.commandBuffer.drawIndexed(terrainBuffers.numIncides, 1, 0, 0, 0);
+		vk::DeviceSize zeroOffset = 0;
 
-		// Draw particles
+		vk::CommandBufferBeginInfo commandBufferInfo{};
+		commandBufferInfo.flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit;
 
-		perFrame.commandBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics, *particlePipeline.pipeline);
+		// Simulate particles on the compute queue, which can overlap with the previous frame's rendering
+		perFrame.computeCommandBuffer.begin(commandBufferInfo);
+		particles.recordSimulation(perFrame.computeCommandBuffer, fmod(time, 3.0));
+		perFrame.computeCommandBuffer.end();
+
+		vk::SubmitInfo computeSubmitInfo{};
+		computeSubmitInfo.commandBufferCount = 1;
+		computeSubmitInfo.pCommandBuffers = &perFrame.computeCommandBuffer;
+		computeSubmitInfo.signalSemaphoreCount = 1;
+		computeSubmitInfo.pSignalSemaphores = &*perFrame.computeSemaphore;
+		// Frame fence covers this too, since the graphics submission waits on its semaphore
+		vulkan.computeQueue.submit(computeSubmitInfo, nullptr);
+
+		if (showStats) {
+			overlay.update();
+		}
 
-		perFrame.commandBuffer.setViewport(0, vulkan.viewport);
-		perFrame.commandBuffer.setScissor(0, vulkan.scissor);
+		double recordStart = glfwGetTime();
+		perFrame.commandBuffer.begin(commandBufferInfo);
+		vulkan.beginFrameTimer(perFrame.commandBuffer);
+		particles.recordAcquire(perFrame.commandBuffer);
+		if (terrain && heightmap) {
+			terrain->recordUpload(perFrame.commandBuffer, terrainStaging, *heightmap);
+		} else if (terrain && terrainBuffers) {
+			terrain->recordUpload(perFrame.commandBuffer, terrainStaging, *terrainBuffers);
+		}
 
-		perFrame.commandBuffer.pushConstants(
-			*particlePipeline.layout,
-			vk::ShaderStageFlagBits::eVertex,
-			0,
-			sizeof(particleState),
-			&particleState
-		);
-		perFrame.commandBuffer.bindVertexBuffers(0, *(particles.buffer), zeroOffset);
-		perFrame.commandBuffer.draw(particleCount, 1, 0, 0);
+		auto drawTerrain = [&](vk::PipelineLayout layout, bool positionsOnly) {
+			uint64_t triangles = 0;
+			if (tessellatedTerrain) {
+				heightmap->drawPatches(perFrame.commandBuffer, layout, instanceRing.buffer(), *terrainInstanceOffset, terrainTransforms.size(), vulkan.renderExtent);
+				// Counted before tessellation, as two triangles per patch
+				triangles = heightmap->patchesPerSide() * heightmap->patchesPerSide() * 2;
+			} else if (heightmap) {
+				heightmap->draw(perFrame.commandBuffer, layout, instanceRing.buffer(), *terrainInstanceOffset, terrainTransforms.size());
+				triangles = (heightmap->size - 1) * (heightmap->size - 1) * 2;
+			} else {
+				terrainBuffers->draw(perFrame.commandBuffer, instanceRing.buffer(), *terrainInstanceOffset, terrainTransforms.size(), positionsOnly);
+				triangles = terrainBuffers->numIncides / 3;
+				// Recently drawn terrain is the last to go under memory pressure
+				if (terrainEviction) {
+					vulkan.memoryBudget.touch(*terrainEviction);
+				}
+			}
+			vulkan.stats.countDraw(triangles * terrainTransforms.size());
+		};
+
+		// The frame is declared as a render graph, which puts the barriers between its passes
+		frameGraph.reset();
+		// Frames still in flight may be writing, blitting or copying the color target
+		GraphImage colorTarget = frameGraph.importImage({
+			*vulkan.colorTarget.image,
+			vk::ImageAspectFlagBits::eColor,
+			vulkan.viewCount,
+			vk::ImageLayout::eUndefined,
+			vk::PipelineStageFlagBits::eColorAttachmentOutput | vk::PipelineStageFlagBits::eTransfer,
+			vk::AccessFlagBits::eColorAttachmentWrite,
+		});
+		// Submission waits for the acquire semaphore in the transfer stage
+		GraphImage swapchainImage = frameGraph.importImage({
+			vulkan.swapchainImages.at(framebufferIndex),
+			vk::ImageAspectFlagBits::eColor,
+			1,
+			vk::ImageLayout::eUndefined,
+			vk::PipelineStageFlagBits::eTransfer,
+			{},
+		});
+		frameGraph.markOutput(swapchainImage, vk::ImageLayout::ePresentSrcKHR);
+
+		// With multiview one pass draws every view, otherwise each view gets a pass of its own
+		uint32_t passLayers = multiview ? vulkan.viewCount : 1;
+		for (uint32_t pass = 0; pass < vulkan.passCount(); pass++) {
+			// Depth only lives through its pass, so the passes of separate views share its memory
+			GraphImage depth = frameGraph.createImage({
+				vulkan.depthFormat,
+				vulkan.viewExtent,
+				vk::ImageUsageFlagBits::eDepthStencilAttachment | vk::ImageUsageFlagBits::eTransientAttachment,
+				vk::ImageAspectFlagBits::eDepth,
+				passLayers,
+				vulkan.samples,
+			});
+			// So do the samples of color, only their resolved average is kept in the color target
+			std::optional<GraphImage> multisampledColor{};
+			if (vulkan.samples != vk::SampleCountFlagBits::e1) {
+				multisampledColor = frameGraph.createImage({
+					vulkan.colorFormat,
+					vulkan.viewExtent,
+					vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eTransientAttachment,
+					vk::ImageAspectFlagBits::eColor,
+					passLayers,
+					vulkan.samples,
+				});
+			}
+			auto &scenePass = frameGraph.addPass("scene", [&, pass, depth, multisampledColor](vk::CommandBuffer commandBuffer) {
+				const glm::mat4 &viewProjection = viewProjections.at(pass);
+				// Multiview shaders take all view matrices from the frame's view buffer instead
+				auto pushView = [&](vk::PipelineLayout layout) {
+					commandBuffer.pushConstants(
+						layout,
+						PUSH_CONSTANT_STAGES,
+						0,
+						sizeof(viewProjection),
+						&viewProjection
+					);
+					if (multiview) {
+						commandBuffer.pushConstants(
+							layout,
+							PUSH_CONSTANT_STAGES,
+							VIEW_BUFFER_PUSH_OFFSET,
+							sizeof(uint32_t),
+							&viewBuffers[vulkan.currentFrame]
+						);
+					}
+				};
+
+				vulkan.beginPass(
+					commandBuffer,
+					pass,
+					multisampledColor ? frameGraph.view(*multisampledColor) : vk::ImageView{},
+					frameGraph.view(depth),
+					clearValues
+				);
+
+				// All pipeline layouts are compatible for the global set, so it's bound just once
+				vulkan.bindGlobalDescriptors(commandBuffer, vk::PipelineBindPoint::eGraphics, *terrainPipeline->layout);
+
+				// Terrain is drawn once it is loaded, checked while recording since realizing the
+				// graph's transients allocates memory
+				bool terrainReady = heightmap ? heightmap->ready : terrainBuffers.has_value();
+				if (terrainReady && terrainInstanceOffset) {
+					// Terrain depth pre-pass
+
+					if (depthPrePass) {
+						commandBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics, *terrainDepthPipeline->pipeline);
+
+						commandBuffer.setViewport(0, vulkan.viewport);
+						commandBuffer.setScissor(0, vulkan.scissor);
+
+						pushView(*terrainDepthPipeline->layout);
+
+						drawTerrain(*terrainDepthPipeline->layout, true);
+					}
+
+					// Draw terrain
+
+					commandBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics, *terrainPipeline->pipeline);
+
+					commandBuffer.setViewport(0, vulkan.viewport);
+					commandBuffer.setScissor(0, vulkan.scissor);
+
+					pushView(*terrainPipeline->layout);
+
+					drawTerrain(*terrainPipeline->layout, false);
+				}
+
+				// Draw particles, after all opaque geometry
+
+				commandBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics, *particlePipeline.pipeline);
+
+				commandBuffer.setViewport(0, vulkan.viewport);
+				commandBuffer.setScissor(0, vulkan.scissor);
+
+				pushView(*particlePipeline.layout);
+				commandBuffer.bindVertexBuffers(0, particles.positions(), zeroOffset);
+				commandBuffer.draw(particles.count, 1, 0, 0);
+				vulkan.stats.countDraw(0);
+				vulkan.stats.current.particles = particles.liveCount;
+
+				// Overlay goes over the first view, or every view with multiview
+				if (showStats && pass == 0) {
+					overlay.draw(commandBuffer);
+				}
+
+				vulkan.endPass(commandBuffer);
+			})
+				.use(colorTarget, ImageAccess::ColorAttachment, pass, passLayers)
+				.use(depth, ImageAccess::DepthAttachment);
+			if (multisampledColor) {
+				scenePass.use(*multisampledColor, ImageAccess::ColorAttachment);
+			}
+		}
 
-		perFrame.commandBuffer.endRenderPass();
-		perFrame.commandBuffer.end();
+		if (capture && (captureCount == 0 || capture->captured < captureCount)) {
+			// Read back by the host, so it's kept even though no pass uses what it writes
+			frameGraph.addPass("capture", [&](vk::CommandBuffer commandBuffer) {
+				capture->record(commandBuffer);
+			}, true)
+				.use(colorTarget, ImageAccess::TransferSource);
+		}
 
+		frameGraph.addPass("present", [&, imageIndex = framebufferIndex](vk::CommandBuffer commandBuffer) {
+			vulkan.recordPresentBlit(commandBuffer, imageIndex);
+		})
+			.use(colorTarget, ImageAccess::TransferSource)
+			.use(swapchainImage, ImageAccess::TransferDestination);
+
+		frameGraph.execute(perFrame.commandBuffer);
+		vulkan.endFrameTimer(perFrame.commandBuffer);
+		perFrame.commandBuffer.end();
+		recordTimeTotal += glfwGetTime() - recordStart;
+
+		// Swap chain image is first touched by the blit, particle positions by vertex input
+		std::array<vk::Semaphore, 2> waitSemaphores {
+			*perFrame.acquireImageSemaphore,
+			*perFrame.computeSemaphore,
+		};
+		std::array<vk::PipelineStageFlags, 2> waitStages {
+			vk::PipelineStageFlagBits::eTransfer,
+			vk::PipelineStageFlagBits::eVertexInput,
+		};
 		vk::SubmitInfo submitInfo{};
-		submitInfo.waitSemaphoreCount = 1;
-		vk::PipelineStageFlags stageFlags = vk::PipelineStageFlagBits::eColorAttachmentOutput;
-		submitInfo.pWaitSemaphores = &*perFrame.acquireImageSemaphore;
-		submitInfo.pWaitDstStageMask = &stageFlags;
+		submitInfo.waitSemaphoreCount = waitSemaphores.size();
+		submitInfo.pWaitSemaphores = waitSemaphores.data();
+		submitInfo.pWaitDstStageMask = waitStages.data();
 		submitInfo.commandBufferCount = 1;
 		submitInfo.pCommandBuffers = &perFrame.commandBuffer;
 		submitInfo.signalSemaphoreCount = 1;
@@ -237,13 +802,34 @@ int main(int argc, char** argv) {
 			continue;
 		}
 
+		framesRendered++;
+		if (benchmarkFrames > 0 && framesRendered >= benchmarkFrames) {
+			glfwSetWindowShouldClose(window, GLFW_TRUE);
+		}
+
 		glfwPollEvents();
 	}
 
 	vulkan.device->waitIdle();
 
-	particlePipeline.reset();
-	terrainPipeline.reset();
+	if (benchmarkFrames > 0 && framesRendered > 0) {
+		printf(
+			"%u views %s: %.3f ms recording, %.3f ms GPU per frame over %zu frames\n",
+			vulkan.viewCount,
+			multiview ? "in one multiview pass" : "in separate passes",
+			recordTimeTotal * 1000.0 / framesRendered,
+			gpuTimeFrames > 0 ? gpuTimeTotal / gpuTimeFrames : 0.0,
+			framesRendered
+		);
+	}
+
+	if (capture) {
+		capture->flush();
+		// Waits for the writer to finish
+		capture.reset();
+	}
+
+	pipelines.reset();
 	vulkan.unsetSurface();
 	vulkan.instance->destroySurfaceKHR(surface);
 
@@ -0,0 +1,209 @@
+#include <cstdio>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "meshfile.hpp"
+
+
+static uint64_t alignUp(uint64_t offset) {
+	return (offset + MESH_ALIGNMENT - 1) / MESH_ALIGNMENT * MESH_ALIGNMENT;
+}
+
+
+// Write a blob at the given offset, padding from the current position
+static bool writeBlob(FILE *file, uint64_t offset, const void *data, size_t size) {
+	static const uint8_t padding[MESH_ALIGNMENT] = {};
+	uint64_t position = ftell(file);
+	if (fwrite(padding, 1, offset - position, file) != offset - position) {
+		return false;
+	}
+	return fwrite(data, 1, size, file) == size;
+}
+
+
+// Write a model as a mesh file
+bool writeMeshFile(const std::filesystem::path &path, Model &model) {
+	auto positions = model.positions();
+
+	MeshHeader header{};
+	header.magic = MESH_MAGIC;
+	header.version = MESH_VERSION;
+	header.vertexStride = sizeof(Vertex);
+	header.indexSize = sizeof(uint32_t);
+	header.vertexCount = model.vertices.size();
+	header.indexCount = model.indices.size();
+	header.vertexOffset = alignUp(sizeof(MeshHeader));
+	header.positionOffset = alignUp(header.vertexOffset + header.vertexCount * sizeof(Vertex));
+	header.indexOffset = alignUp(header.positionOffset + header.vertexCount * sizeof(glm::vec3));
+
+	FILE *file = fopen(path.c_str(), "wb");
+	if (file == nullptr) {
+		return false;
+	}
+	bool ok = (
+		fwrite(&header, sizeof(header), 1, file) == 1 &&
+		writeBlob(file, header.vertexOffset, model.vertices.data(), header.vertexCount * sizeof(Vertex)) &&
+		writeBlob(file, header.positionOffset, positions.data(), header.vertexCount * sizeof(glm::vec3)) &&
+		writeBlob(file, header.indexOffset, model.indices.data(), header.indexCount * sizeof(uint32_t))
+	);
+	return fclose(file) == 0 && ok;
+}
+
+
+MappedMesh::MappedMesh(const uint8_t *data, size_t size): data(data), size(size) {
+}
+
+
+MappedMesh::MappedMesh(MappedMesh &&other): data(other.data), size(other.size) {
+	other.data = nullptr;
+	other.size = 0;
+}
+
+
+MappedMesh::~MappedMesh() {
+	if (data != nullptr) {
+		munmap(const_cast<uint8_t*>(data), size);
+	}
+}
+
+
+// Whether a blob of count elements at offset lies within a file of the given size
+// Written so that no step can overflow, header values come straight from the file
+static bool blobFits(uint64_t offset, uint64_t count, uint64_t elementSize, uint64_t fileSize) {
+	return offset <= fileSize && count <= (fileSize - offset) / elementSize;
+}
+
+
+// Map a mesh file, checking the header matches the current format
+// and that every index refers to a vertex, so a corrupt cache can't make the GPU read out of range
+std::optional<MappedMesh> MappedMesh::open(const std::filesystem::path &path) {
+	int fd = ::open(path.c_str(), O_RDONLY);
+	if (fd < 0) {
+		return {};
+	}
+	struct stat info;
+	if (fstat(fd, &info) != 0 || (size_t) info.st_size < sizeof(MeshHeader)) {
+		close(fd);
+		return {};
+	}
+	void *mapping = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	// The mapping stays valid after closing the file
+	close(fd);
+	if (mapping == MAP_FAILED) {
+		return {};
+	}
+	// Blobs are read front to back, indices once to check them and once to upload
+	madvise(mapping, info.st_size, MADV_SEQUENTIAL);
+	MappedMesh mesh{static_cast<const uint8_t*>(mapping), (size_t) info.st_size};
+
+	auto &header = mesh.header();
+	if (
+		header.magic != MESH_MAGIC ||
+		header.version != MESH_VERSION ||
+		header.vertexStride != sizeof(Vertex) ||
+		header.indexSize != sizeof(uint32_t) ||
+		!blobFits(header.vertexOffset, header.vertexCount, sizeof(Vertex), mesh.size) ||
+		!blobFits(header.positionOffset, header.vertexCount, sizeof(glm::vec3), mesh.size) ||
+		!blobFits(header.indexOffset, header.indexCount, sizeof(uint32_t), mesh.size) ||
+		header.indexOffset % alignof(uint32_t) != 0
+	) {
+		return {};
+	}
+	auto indices = reinterpret_cast<const uint32_t*>(mesh.data + header.indexOffset);
+	for (uint64_t i = 0; i < header.indexCount; i++) {
+		if (indices[i] >= header.vertexCount) {
+			return {};
+		}
+	}
+	return mesh;
+}
+
+
+const MeshHeader &MappedMesh::header() const {
+	return *reinterpret_cast<const MeshHeader*>(data);
+}
+
+
+// Upload the mapped blobs to device memory, pages are faulted in by the copy
+UploadedModel MappedMesh::upload(VulkanState &vulkan) const {
+	auto &meshHeader = header();
+	return UploadedModel::fromData(
+		data + meshHeader.vertexOffset, meshHeader.vertexCount * sizeof(Vertex),
+		data + meshHeader.positionOffset, meshHeader.vertexCount * sizeof(glm::vec3),
+		data + meshHeader.indexOffset, meshHeader.indexCount,
+		vulkan
+	);
+}
+
+
+MeshLoader::MeshLoader(VulkanState &vulkan): vulkan(vulkan) {
+	loader = std::thread([this] { loadLoop(); });
+}
+
+
+MeshLoader::~MeshLoader() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	wake.notify_all();
+	loader.join();
+}
+
+
+// Queue a mesh file for loading
+void MeshLoader::request(std::filesystem::path path) {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		requests.push_back(path);
+	}
+	wake.notify_one();
+}
+
+
+// Take the meshes that finished loading since the last call
+std::vector<MeshLoader::Result> MeshLoader::poll() {
+	std::lock_guard<std::mutex> lock(mutex);
+	std::vector<Result> result = std::move(finished);
+	finished.clear();
+	return result;
+}
+
+
+// Loader thread, creates buffers and copies mapped data without touching any queue,
+// so it can run alongside frame submission on the main thread
+void MeshLoader::loadLoop() {
+	std::unique_lock<std::mutex> lock(mutex);
+	while (true) {
+		wake.wait(lock, [this] { return stopping || !requests.empty(); });
+		if (stopping) {
+			return;
+		}
+		auto path = requests.front();
+		requests.pop_front();
+		lock.unlock();
+
+		std::optional<UploadedModel> model{};
+		auto mesh = MappedMesh::open(path);
+		if (mesh) {
+			// Evictions this thread asks for only happen on the next frame, so memory can run out
+			// here even when the render thread could make room; it gets an empty model and retries
+			try {
+				model = mesh->upload(vulkan);
+			} catch (vk::OutOfDeviceMemoryError &e) {
+				fprintf(stderr, "Out of device memory loading mesh %s\n", path.c_str());
+			} catch (vk::OutOfHostMemoryError &e) {
+				fprintf(stderr, "Out of host memory loading mesh %s\n", path.c_str());
+			}
+		} else {
+			fprintf(stderr, "Could not load mesh %s\n", path.c_str());
+		}
+
+		lock.lock();
+		finished.emplace_back(path, std::move(model));
+	}
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+// Binary mesh container and background loader
+// A mesh file is a header followed by the vertex, position and index blobs, each aligned
+// so they can be copied straight from a memory mapped file into buffers without parsing.
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "model.hpp"
+#include "vulkan.hpp"
+
+
+// "VKDM" when read as bytes
+const uint32_t MESH_MAGIC = 0x4d444b56;
+// Bump when the layout of the header or the blobs changes
+const uint32_t MESH_VERSION = 1;
+// Alignment of each blob in the file
+const uint64_t MESH_ALIGNMENT = 256;
+
+
+// Header at the start of a mesh file, offsets are from the start of the file
+struct MeshHeader {
+	uint32_t magic;
+	uint32_t version;
+	// Sizes of a single vertex and index, to check the file matches our layout
+	uint32_t vertexStride;
+	uint32_t indexSize;
+	uint64_t vertexCount;
+	uint64_t indexCount;
+	uint64_t vertexOffset;
+	uint64_t positionOffset;
+	uint64_t indexOffset;
+};
+
+
+// Write a model as a mesh file, returns whether it succeeded
+bool writeMeshFile(const std::filesystem::path &path, Model &model);
+
+
+// Read-only memory mapping of a mesh file
+class MappedMesh
+{
+public:
+	// Map a mesh file, empty if it can't be read, doesn't match the current format, has blobs
+	// outside the file or indices past its vertices
+	static std::optional<MappedMesh> open(const std::filesystem::path &path);
+
+	MappedMesh(MappedMesh &&other);
+	MappedMesh(const MappedMesh&) = delete;
+	~MappedMesh();
+
+	const MeshHeader &header() const;
+
+	// Upload the mapped blobs to device memory
+	UploadedModel upload(VulkanState &vulkan) const;
+
+private:
+	const uint8_t *data = nullptr;
+	size_t size = 0;
+
+	MappedMesh(const uint8_t *data, size_t size);
+};
+
+
+// Loads mesh files into device memory on a background thread
+class MeshLoader
+{
+public:
+	// Path of a requested mesh and its model, empty if loading failed
+	using Result = std::pair<std::filesystem::path, std::optional<UploadedModel>>;
+
+	MeshLoader(VulkanState &vulkan);
+	~MeshLoader();
+
+	// Queue a mesh file for loading
+	void request(std::filesystem::path path);
+
+	// Take the meshes that finished loading since the last call
+	std::vector<Result> poll();
+
+private:
+	VulkanState &vulkan;
+
+	// Guards the queues, shared with the loader thread
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::deque<std::filesystem::path> requests;
+	std::vector<Result> finished;
+	bool stopping = false;
+	std::thread loader;
+
+	void loadLoop();
+};
@@ -1,21 +1,80 @@
+#include <array>
+
 #include "model.hpp"
 
 
+// Packed vertex positions, for depth only passes
+std::vector<glm::vec3> Model::positions() {
+	std::vector<glm::vec3> result{};
+	result.reserve(vertices.size());
+	for (auto &vertex: vertices) {
+		result.push_back(vertex.pos);
+	}
+	return result;
+}
+
+
 // Upload model to device memory
 UploadedModel UploadedModel::fromModel(Model &model, VulkanState &vulkan) {
-	auto vertices = vulkan.createBufferWithData(
-		vk::BufferUsageFlagBits::eVertexBuffer,
+	auto positions = model.positions();
+	return fromData(
+		reinterpret_cast<uint8_t*>(model.vertices.data()),
 		model.vertices.size() * sizeof(model.vertices[0]),
-		reinterpret_cast<uint8_t*>(model.vertices.data())
+		reinterpret_cast<uint8_t*>(positions.data()),
+		positions.size() * sizeof(positions[0]),
+		reinterpret_cast<uint8_t*>(model.indices.data()),
+		model.indices.size(),
+		vulkan
+	);
+}
+
+
+// Upload vertex, position and index data that is already laid out for the GPU
+UploadedModel UploadedModel::fromData(
+	const uint8_t *vertexData, size_t vertexSize,
+	const uint8_t *positionData, size_t positionSize,
+	const uint8_t *indexData, size_t numIndices,
+	VulkanState &vulkan
+) {
+	// Vertices can be partially rewritten by copies, e.g. for terrain editing
+	auto vertices = vulkan.createBufferWithData(
+		vk::BufferUsageFlagBits::eVertexBuffer | vk::BufferUsageFlagBits::eTransferDst,
+		vertexSize,
+		vertexData
+	);
+	auto positions = vulkan.createBufferWithData(
+		vk::BufferUsageFlagBits::eVertexBuffer | vk::BufferUsageFlagBits::eTransferDst,
+		positionSize,
+		positionData
 	);
 	auto indices = vulkan.createBufferWithData(
 		vk::BufferUsageFlagBits::eIndexBuffer,
-		model.indices.size() * sizeof(model.indices[0]),
-		reinterpret_cast<uint8_t*>(model.indices.data())
+		numIndices * sizeof(uint32_t),
+		indexData
 	);
 	return {
 		std::move(vertices),
+		std::move(positions),
 		std::move(indices),
-		model.indices.size()
+		numIndices
+	};
+}
+
+
+// Record an instanced draw, with a model transform per instance read from vertex binding 1
+void UploadedModel::draw(
+	vk::CommandBuffer commandBuffer,
+	vk::Buffer transforms,
+	vk::DeviceSize transformOffset,
+	uint32_t instanceCount,
+	bool positionsOnly
+) const {
+	std::array<vk::Buffer, 2> buffers {
+		positionsOnly ? *positions.buffer : *vertices.buffer,
+		transforms,
 	};
-}
\ No newline at end of file
+	std::array<vk::DeviceSize, 2> offsets {0, transformOffset};
+	commandBuffer.bindVertexBuffers(0, buffers, offsets);
+	commandBuffer.bindIndexBuffer(*indices.buffer, 0, vk::IndexType::eUint32);
+	commandBuffer.drawIndexed(numIncides, instanceCount, 0, 0, 0);
+}
@@ -22,15 +22,38 @@ struct Vertex {
 struct Model {
 	std::vector<Vertex> vertices;
 	std::vector<uint32_t> indices;
+
+	// Packed vertex positions, for depth only passes
+	std::vector<glm::vec3> positions();
 };
 
 
 // Drawable model with vertex and index buffers uploaded to device memory
 struct UploadedModel {
 	BufferAndMemory vertices;
+	// Tightly packed positions only, for depth only passes
+	BufferAndMemory positions;
 	BufferAndMemory indices;
 	size_t numIncides;
 
+	// Record an instanced draw, with a model transform per instance read from vertex binding 1
+	// Binds the packed positions instead of the full vertices for depth only pipelines
+	void draw(
+		vk::CommandBuffer commandBuffer,
+		vk::Buffer transforms,
+		vk::DeviceSize transformOffset,
+		uint32_t instanceCount,
+		bool positionsOnly = false
+	) const;
+
 	// Upload model to device memory
 	static UploadedModel fromModel(Model &model, VulkanState &vulkan);
-};
\ No newline at end of file
+
+	// Upload vertex, position and index data that is already laid out for the GPU
+	static UploadedModel fromData(
+		const uint8_t *vertices, size_t vertexSize,
+		const uint8_t *positions, size_t positionSize,
+		const uint8_t *indices, size_t numIndices,
+		VulkanState &vulkan
+	);
+};
@@ -0,0 +1,185 @@
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <cstdarg>
+#include <cstdio>
+
+#include "overlay.hpp"
+
+// Size of a font pixel in screen pixels
+static const float FONT_SCALE = 2.0f;
+// Glyph cell size including spacing, in font pixels, see overlay.frag
+static const glm::vec2 GLYPH_CELL{6.0f, 8.0f};
+// Most quads drawn in one frame
+static const size_t MAX_QUADS = 2048;
+// Bars in the frame time histogram
+static const size_t HISTOGRAM_BINS = 32;
+static const float HISTOGRAM_HEIGHT = 40.0f;
+
+static const uint32_t TEXT_COLOR = 0xffffffff;
+static const uint32_t DIM_COLOR = 0xffa0a0a0;
+static const uint32_t BAR_COLOR = 0xff40c0ff;
+static const uint32_t PANEL_COLOR = 0xff202020;
+
+
+// printf into a string, lines are short so a fixed buffer will do
+static std::string format(const char *fmt, ...) {
+	char buffer[128];
+	va_list args;
+	va_start(args, fmt);
+	vsnprintf(buffer, sizeof(buffer), fmt, args);
+	va_end(args);
+	return buffer;
+}
+
+
+StatsOverlay::StatsOverlay(VulkanState &vulkan, std::vector<uint8_t> vertexCode, std::vector<uint8_t> fragmentCode):
+	vulkan(vulkan),
+	quadRing(vulkan, vk::BufferUsageFlagBits::eVertexBuffer, MAX_QUADS * sizeof(OverlayQuad))
+{
+	vk::VertexInputBindingDescription binding{};
+	binding.binding = 0;
+	binding.stride = sizeof(OverlayQuad);
+	binding.inputRate = vk::VertexInputRate::eInstance;
+	std::array<vk::VertexInputAttributeDescription, 4> attributes{{
+		{0, 0, vk::Format::eR32G32Sfloat, offsetof(OverlayQuad, position)},
+		{1, 0, vk::Format::eR32G32Sfloat, offsetof(OverlayQuad, size)},
+		{2, 0, vk::Format::eR32Uint, offsetof(OverlayQuad, glyph)},
+		{3, 0, vk::Format::eR32Uint, offsetof(OverlayQuad, color)},
+	}};
+	vk::PipelineVertexInputStateCreateInfo vertexInputInfo{};
+	vertexInputInfo.vertexBindingDescriptionCount = 1;
+	vertexInputInfo.pVertexBindingDescriptions = &binding;
+	vertexInputInfo.vertexAttributeDescriptionCount = attributes.size();
+	vertexInputInfo.pVertexAttributeDescriptions = attributes.data();
+
+	pipeline = vulkan.makePipeline(
+		{
+			{vk::ShaderStageFlagBits::eVertex, vertexCode},
+			{vk::ShaderStageFlagBits::eFragment, fragmentCode},
+		},
+		vertexInputInfo,
+		vk::PrimitiveTopology::eTriangleList,
+		sizeof(glm::vec2),
+		DepthMode::Disabled
+	);
+}
+
+
+// Lay out the statistics of the last frames
+void StatsOverlay::update() {
+	const RendererStats &stats = vulkan.stats;
+	quads.clear();
+
+	std::vector<std::string> lines{};
+	float cpuTime = stats.cpuFrameTime.average();
+	lines.push_back(format(
+		"FPS %.0f  CPU %.2f MS  GPU %.2f MS",
+		cpuTime > 0.0f ? 1000.0f / cpuTime : 0.0f,
+		cpuTime,
+		stats.gpuFrameTime.average()
+	));
+	lines.push_back(format("FENCE WAIT %.2f MS  MAX %.2f MS", stats.fenceWaitTime.average(), stats.fenceWaitTime.max()));
+	lines.push_back(format("DRAWS %u  TRIANGLES %llu", stats.last.draws, (unsigned long long) stats.last.triangles));
+	lines.push_back(format("PARTICLES %u LIVE", stats.last.particles));
+	lines.push_back(format("PASSES %u  CULLED %u  BARRIERS %u", stats.last.passes, stats.last.culledPasses, stats.last.barriers));
+	lines.push_back(format(
+		"RENDER SCALE %.2f  VIEWS %u  MSAA %uX",
+		vulkan.renderScale,
+		vulkan.viewCount,
+		(uint32_t) vulkan.samples
+	));
+	lines.push_back(format("SWAPCHAIN RECREATIONS %u", stats.swapchainRecreations));
+	auto heaps = vulkan.heapStats();
+	for (size_t i = 0; i < heaps.size(); i++) {
+		lines.push_back(format(
+			"HEAP %zu %s %.1f MB IN %u ALLOCS  %.0f / %.0f MB",
+			i,
+			heaps[i].deviceLocal ? "DEVICE" : "HOST",
+			heaps[i].used / (1024.0 * 1024.0),
+			heaps[i].allocations,
+			heaps[i].usage / (1024.0 * 1024.0),
+			heaps[i].budget / (1024.0 * 1024.0)
+		));
+	}
+
+	// GPU frame times when the device has timestamps, CPU ones otherwise
+	bool gpuTimes = stats.gpuFrameTime.size() > 0;
+	auto &times = gpuTimes ? stats.gpuFrameTime : stats.cpuFrameTime;
+	float upper = std::max(times.max(), 1.0f);
+	lines.push_back(format("%s FRAME TIME 0 - %.1f MS", gpuTimes ? "GPU" : "CPU", upper));
+
+	glm::vec2 lineSize = GLYPH_CELL * FONT_SCALE;
+	size_t longest = 0;
+	for (auto &line: lines) {
+		longest = std::max(longest, line.size());
+	}
+	glm::vec2 margin{lineSize.y / 2};
+	glm::vec2 panelSize{
+		std::max(longest * lineSize.x, HISTOGRAM_BINS * lineSize.x / 2.0f),
+		lines.size() * lineSize.y + HISTOGRAM_HEIGHT
+	};
+	rectangle(glm::vec2{0}, panelSize + margin * 2.0f, PANEL_COLOR);
+
+	glm::vec2 position = margin;
+	for (auto &line: lines) {
+		text(position, line, line.rfind("HEAP", 0) == 0 ? DIM_COLOR : TEXT_COLOR);
+		position.y += lineSize.y;
+	}
+
+	auto bins = times.histogram<HISTOGRAM_BINS>(upper);
+	uint32_t fullest = std::max(*std::max_element(bins.begin(), bins.end()), 1u);
+	float barWidth = lineSize.x / 2;
+	for (size_t i = 0; i < bins.size(); i++) {
+		float height = HISTOGRAM_HEIGHT * bins[i] / fullest;
+		rectangle(
+			glm::vec2{position.x + i * barWidth, position.y + HISTOGRAM_HEIGHT - height},
+			glm::vec2{barWidth - 1.0f, height},
+			BAR_COLOR
+		);
+	}
+
+	quads.resize(std::min(quads.size(), MAX_QUADS));
+	quadRing.beginFrame(vulkan.currentFrame);
+	quadOffset = quadRing.push(quads.data(), quads.size() * sizeof(OverlayQuad), sizeof(OverlayQuad));
+}
+
+
+// Record drawing the overlay, inside the render pass
+void StatsOverlay::draw(vk::CommandBuffer commandBuffer) {
+	if (!quadOffset || quads.empty()) {
+		return;
+	}
+	commandBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics, *pipeline.pipeline);
+	commandBuffer.setViewport(0, vulkan.viewport);
+	commandBuffer.setScissor(0, vulkan.scissor);
+
+	// Laid out in swap chain pixels of one view, so text keeps its size at any render scale
+	glm::vec2 screenSize{(float) vulkan.viewExtent.width, (float) vulkan.viewExtent.height};
+	commandBuffer.pushConstants(*pipeline.layout, PUSH_CONSTANT_STAGES, 0, sizeof(screenSize), &screenSize);
+	commandBuffer.bindVertexBuffers(0, quadRing.buffer(), *quadOffset);
+	commandBuffer.draw(6, quads.size(), 0, 0);
+	vulkan.stats.countDraw(quads.size() * 2);
+}
+
+
+// Add a line of text
+void StatsOverlay::text(glm::vec2 position, const std::string &line, uint32_t color) {
+	glm::vec2 cellSize = GLYPH_CELL * FONT_SCALE;
+	for (char c: line) {
+		c = std::toupper((unsigned char) c);
+		if (c < OVERLAY_FIRST_GLYPH || c > OVERLAY_LAST_GLYPH) {
+			c = '?';
+		}
+		if (c != ' ') {
+			quads.push_back({position, cellSize, (uint32_t) (c - OVERLAY_FIRST_GLYPH), color});
+		}
+		position.x += cellSize.x;
+	}
+}
+
+
+// Add a filled rectangle
+void StatsOverlay::rectangle(glm::vec2 position, glm::vec2 size, uint32_t color) {
+	quads.push_back({position, size, OVERLAY_SOLID, color});
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+// On-screen statistics overlay
+// Lines of text and a frame time histogram, drawn as instanced quads over the rendered image.
+// Glyphs come from a small bitmap font in overlay.frag, so no font texture is needed.
+
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "ring.hpp"
+#include "vulkan.hpp"
+
+
+// First character in the overlay.frag font, which goes up to 'Z'
+const char OVERLAY_FIRST_GLYPH = ' ';
+const char OVERLAY_LAST_GLYPH = 'Z';
+// Glyph of quads that are filled completely
+const uint32_t OVERLAY_SOLID = 0xffffffff;
+
+
+// Quad of the overlay, one instance of overlay.vert
+struct OverlayQuad {
+	// Top left corner and size in pixels
+	glm::vec2 position;
+	glm::vec2 size;
+	// Index in the font, or OVERLAY_SOLID
+	uint32_t glyph;
+	// 0xAABBGGRR
+	uint32_t color;
+};
+
+
+class StatsOverlay
+{
+public:
+	StatsOverlay(VulkanState &vulkan, std::vector<uint8_t> vertexCode, std::vector<uint8_t> fragmentCode);
+
+	// Lay out the statistics of the last frames into this frame's region of the quad ring
+	void update();
+
+	// Record drawing the overlay laid out by update, inside the render pass
+	void draw(vk::CommandBuffer commandBuffer);
+
+private:
+	VulkanState &vulkan;
+	Pipeline pipeline{};
+	MappedRing quadRing;
+	std::vector<OverlayQuad> quads{};
+	std::optional<vk::DeviceSize> quadOffset{};
+
+	// Add a line of text with its top left corner at the given pixel position
+	void text(glm::vec2 position, const std::string &line, uint32_t color);
+
+	// Add a filled rectangle
+	void rectangle(glm::vec2 position, glm::vec2 size, uint32_t color);
+};
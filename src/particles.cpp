@@ -2,9 +2,19 @@
 
 #include "particles.hpp"
 
-// Make a static buffer with particles
-// Returns a buffer and the number of particles
-std::pair<BufferAndMemory, size_t> makeParticles(VulkanState &vulkan) {
+// Threads per workgroup in particle.comp
+static const uint32_t WORKGROUP_SIZE = 64;
+
+
+// Push constants for the simulation shader
+struct SimulationState {
+	float time;
+	uint32_t count;
+};
+
+
+// Set up the particles and the per-frame buffers the simulation writes to
+ParticleSystem::ParticleSystem(VulkanState &vulkan, std::vector<uint8_t> computeShaderCode, float gravity): vulkan(vulkan) {
 	// Just hardcode a few particles for now
 	std::vector<Particle> particles {
 		{
@@ -24,9 +34,163 @@ std::pair<BufferAndMemory, size_t> makeParticles(VulkanState &vulkan) {
 			{-0.02, 2.7, 0.22}
 		}
 	};
+	count = particles.size();
 
-	return {
-		vulkan.createBufferWithData(vk::BufferUsageFlagBits::eVertexBuffer, particles.size() * sizeof(Particle), reinterpret_cast<uint8_t*>(particles.data())),
-		particles.size()
-	};
-}
\ No newline at end of file
+	initialState = vulkan.createBufferWithData(
+		vk::BufferUsageFlagBits::eStorageBuffer,
+		particles.size() * sizeof(Particle),
+		reinterpret_cast<uint8_t*>(particles.data())
+	);
+	for (auto &output: outputs) {
+		output = vulkan.createBuffer(
+			vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eVertexBuffer,
+			count * sizeof(glm::vec4),
+			vk::MemoryPropertyFlagBits::eDeviceLocal
+		);
+	}
+	for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+		liveCounters[i] = vulkan.createBuffer(
+			vk::BufferUsageFlagBits::eStorageBuffer,
+			sizeof(uint32_t),
+			vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent
+		);
+		mappedLiveCounters[i] = static_cast<uint32_t*>(vulkan.device->mapMemory(*liveCounters[i].memory, 0, sizeof(uint32_t), {}));
+		*mappedLiveCounters[i] = 0;
+	}
+
+	std::array<vk::DescriptorSetLayoutBinding, 3> bindings{};
+	for (uint32_t i = 0; i < bindings.size(); i++) {
+		bindings[i].binding = i;
+		bindings[i].descriptorType = vk::DescriptorType::eStorageBuffer;
+		bindings[i].descriptorCount = 1;
+		bindings[i].stageFlags = vk::ShaderStageFlagBits::eCompute;
+	}
+	vk::DescriptorSetLayoutCreateInfo layoutInfo{};
+	layoutInfo.bindingCount = bindings.size();
+	layoutInfo.pBindings = bindings.data();
+	setLayout = vulkan.device->createDescriptorSetLayoutUnique(layoutInfo);
+
+	vk::DescriptorPoolSize poolSize{vk::DescriptorType::eStorageBuffer, (uint32_t) (bindings.size() * MAX_FRAMES_IN_FLIGHT)};
+	vk::DescriptorPoolCreateInfo poolInfo{};
+	poolInfo.maxSets = MAX_FRAMES_IN_FLIGHT;
+	poolInfo.poolSizeCount = 1;
+	poolInfo.pPoolSizes = &poolSize;
+	descriptorPool = vulkan.device->createDescriptorPoolUnique(poolInfo);
+
+	std::vector<vk::DescriptorSetLayout> setLayouts(MAX_FRAMES_IN_FLIGHT, *setLayout);
+	vk::DescriptorSetAllocateInfo allocateInfo{};
+	allocateInfo.descriptorPool = *descriptorPool;
+	allocateInfo.descriptorSetCount = setLayouts.size();
+	allocateInfo.pSetLayouts = setLayouts.data();
+	descriptorSets = vulkan.device->allocateDescriptorSets(allocateInfo);
+
+	for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+		vk::DescriptorBufferInfo inputInfo{*initialState.buffer, 0, VK_WHOLE_SIZE};
+		vk::DescriptorBufferInfo outputInfo{*outputs[i].buffer, 0, VK_WHOLE_SIZE};
+		vk::DescriptorBufferInfo liveCounterInfo{*liveCounters[i].buffer, 0, VK_WHOLE_SIZE};
+		std::array<vk::WriteDescriptorSet, 3> writes{};
+		writes[0].dstSet = descriptorSets[i];
+		writes[0].dstBinding = 0;
+		writes[0].descriptorCount = 1;
+		writes[0].descriptorType = vk::DescriptorType::eStorageBuffer;
+		writes[0].pBufferInfo = &inputInfo;
+		writes[1].dstSet = descriptorSets[i];
+		writes[1].dstBinding = 1;
+		writes[1].descriptorCount = 1;
+		writes[1].descriptorType = vk::DescriptorType::eStorageBuffer;
+		writes[1].pBufferInfo = &outputInfo;
+		writes[2].dstSet = descriptorSets[i];
+		writes[2].dstBinding = 2;
+		writes[2].descriptorCount = 1;
+		writes[2].descriptorType = vk::DescriptorType::eStorageBuffer;
+		writes[2].pBufferInfo = &liveCounterInfo;
+		vulkan.device->updateDescriptorSets(writes, nullptr);
+	}
+
+	pipeline = vulkan.makeComputePipeline(
+		computeShaderCode,
+		{*setLayout},
+		sizeof(SimulationState),
+		SpecializationConstants{}.set(PARTICLE_GRAVITY, gravity)
+	);
+}
+
+
+// Record simulating the particles into the current frame's compute command buffer
+void ParticleSystem::recordSimulation(vk::CommandBuffer commandBuffer, float time) {
+	// The last simulation of this frame index is done, take its count and start over
+	uint32_t *liveCounter = mappedLiveCounters[vulkan.currentFrame];
+	liveCount = *liveCounter;
+	*liveCounter = 0;
+
+	SimulationState state{time, (uint32_t) count};
+	commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, *pipeline.pipeline);
+	commandBuffer.bindDescriptorSets(
+		vk::PipelineBindPoint::eCompute,
+		*pipeline.layout,
+		0,
+		descriptorSets[vulkan.currentFrame],
+		nullptr
+	);
+	commandBuffer.pushConstants(*pipeline.layout, vk::ShaderStageFlagBits::eCompute, 0, sizeof(state), &state);
+	commandBuffer.dispatch((count + WORKGROUP_SIZE - 1) / WORKGROUP_SIZE, 1, 1);
+
+	// Count is read by the host after the frame's fence
+	vk::BufferMemoryBarrier toHost{};
+	toHost.srcAccessMask = vk::AccessFlagBits::eShaderWrite;
+	toHost.dstAccessMask = vk::AccessFlagBits::eHostRead;
+	toHost.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	toHost.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	toHost.buffer = *liveCounters[vulkan.currentFrame].buffer;
+	toHost.offset = 0;
+	toHost.size = VK_WHOLE_SIZE;
+	commandBuffer.pipelineBarrier(
+		vk::PipelineStageFlagBits::eComputeShader,
+		vk::PipelineStageFlagBits::eHost,
+		{}, nullptr, toHost, nullptr
+	);
+
+	// Release to the graphics family, the acquire half is recorded by recordAcquire
+	// Without a separate family the semaphore between the submissions is all we need
+	if (vulkan.hasAsyncCompute()) {
+		auto release = ownershipBarrier();
+		release.srcAccessMask = vk::AccessFlagBits::eShaderWrite;
+		commandBuffer.pipelineBarrier(
+			vk::PipelineStageFlagBits::eComputeShader,
+			vk::PipelineStageFlagBits::eBottomOfPipe,
+			{}, nullptr, release, nullptr
+		);
+	}
+	// Output isn't released back to the compute family after drawing, as the next
+	// simulation overwrites it completely and doesn't need its old contents
+}
+
+
+// Record taking over the simulated positions on the graphics queue
+void ParticleSystem::recordAcquire(vk::CommandBuffer commandBuffer) {
+	if (vulkan.hasAsyncCompute()) {
+		auto acquire = ownershipBarrier();
+		acquire.dstAccessMask = vk::AccessFlagBits::eVertexAttributeRead;
+		commandBuffer.pipelineBarrier(
+			vk::PipelineStageFlagBits::eTopOfPipe,
+			vk::PipelineStageFlagBits::eVertexInput,
+			{}, nullptr, acquire, nullptr
+		);
+	}
+}
+
+
+vk::Buffer ParticleSystem::positions() const {
+	return *outputs[vulkan.currentFrame].buffer;
+}
+
+
+vk::BufferMemoryBarrier ParticleSystem::ownershipBarrier() const {
+	vk::BufferMemoryBarrier barrier{};
+	barrier.srcQueueFamilyIndex = vulkan.computeQueueFamily;
+	barrier.dstQueueFamilyIndex = vulkan.queueFamily;
+	barrier.buffer = *outputs[vulkan.currentFrame].buffer;
+	barrier.offset = 0;
+	barrier.size = VK_WHOLE_SIZE;
+	return barrier;
+}
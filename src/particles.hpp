@@ -1,15 +1,60 @@
 #pragma once
 
-#include <utility>
+#include <array>
+#include <vector>
 
 #include "vulkan.hpp"
 
 
-// Vertex layout for particles
+// Specialization constant ids of particle.comp and particle.vert
+const uint32_t PARTICLE_GRAVITY = 0;
+const uint32_t PARTICLE_POINT_SIZE = 0;
+
+
+// Initial state of a particle, laid out as 6 floats for the simulation shader
 struct Particle {
 	glm::vec3 pos0;
 	glm::vec3 v0;
 };
 
 
-std::pair<BufferAndMemory, size_t> makeParticles(VulkanState &vulkan);
\ No newline at end of file
+// Particles simulated by a compute shader on the compute queue, and drawn as points
+// from the positions written for the same frame
+class ParticleSystem
+{
+public:
+	// Particles in the pool, simulated each frame
+	size_t count;
+	// Particles above ground in the simulation last run with the current frame's index, read back
+	// by recordSimulation once that frame's fence was waited for
+	uint32_t liveCount = 0;
+
+	// Gravity is baked into the simulation pipeline as a specialization constant
+	ParticleSystem(VulkanState &vulkan, std::vector<uint8_t> computeShaderCode, float gravity = 1.0);
+
+	// Record simulating the particles at a time into the current frame's compute command buffer
+	// The frame's fence must have been waited for, to read back its last live count
+	void recordSimulation(vk::CommandBuffer commandBuffer, float time);
+
+	// Record taking over the simulated positions on the graphics queue, before drawing them
+	void recordAcquire(vk::CommandBuffer commandBuffer);
+
+	// Positions simulated for the current frame, a vec4 per particle with w 0 for hidden particles
+	vk::Buffer positions() const;
+
+private:
+	VulkanState &vulkan;
+	BufferAndMemory initialState{};
+	// Written by the compute queue while earlier frames may still be drawing their own copy
+	std::array<BufferAndMemory, MAX_FRAMES_IN_FLIGHT> outputs{};
+	// Live particles counted by the simulation of each frame, mapped for reading back
+	std::array<BufferAndMemory, MAX_FRAMES_IN_FLIGHT> liveCounters{};
+	std::array<uint32_t*, MAX_FRAMES_IN_FLIGHT> mappedLiveCounters{};
+	vk::UniqueDescriptorSetLayout setLayout{};
+	vk::UniqueDescriptorPool descriptorPool{};
+	std::vector<vk::DescriptorSet> descriptorSets{};
+	Pipeline pipeline{};
+
+	// Barrier moving the current output between the compute and graphics queue families
+	vk::BufferMemoryBarrier ownershipBarrier() const;
+};
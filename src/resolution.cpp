@@ -0,0 +1,42 @@
+#include <algorithm>
+#include <cmath>
+
+#include "resolution.hpp"
+
+// Weight of a new sample in the smoothed frame time
+static const double SMOOTHING = 0.1;
+// Aim a bit below the budget so small fluctuations don't go over it
+static const double HEADROOM = 0.9;
+// Don't touch the scale while within this fraction of the target time
+static const double DEADBAND = 0.05;
+// Fraction of the distance to the ideal scale to move each frame
+static const float RATE = 0.2;
+
+
+DynamicResolution::DynamicResolution(float budget): budget(budget) {
+}
+
+
+// Feed in the GPU time of a finished frame, returns the new render scale
+float DynamicResolution::update(double gpuFrameTime) {
+	if (gpuFrameTime <= 0.0) {
+		// No measurement available
+		return scale;
+	}
+	if (smoothedTime == 0.0) {
+		smoothedTime = gpuFrameTime;
+	} else {
+		smoothedTime += (gpuFrameTime - smoothedTime) * SMOOTHING;
+	}
+
+	double target = budget * HEADROOM;
+	if (std::abs(smoothedTime - target) < target * DEADBAND) {
+		return scale;
+	}
+
+	// GPU time is roughly proportional to the pixel count, so to the square of the scale
+	float ideal = scale * (float) sqrt(target / smoothedTime);
+	ideal = std::clamp(ideal, minScale, maxScale);
+	scale += (ideal - scale) * RATE;
+	return scale;
+}
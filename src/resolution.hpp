@@ -0,0 +1,26 @@
+#pragma once
+
+// Dynamic resolution scaling
+// Picks a render scale from measured GPU frame times to stay within a frame time budget
+
+
+class DynamicResolution
+{
+public:
+	// Target GPU time per frame in milliseconds
+	float budget;
+	// Range the render scale is kept in
+	float minScale = 0.5;
+	float maxScale = 1.0;
+	// Current render scale, fraction of the full resolution per axis
+	float scale = 1.0;
+
+	DynamicResolution(float budget);
+
+	// Feed in the GPU time of a finished frame in milliseconds, returns the new render scale
+	float update(double gpuFrameTime);
+
+private:
+	// Exponentially smoothed frame time so single spikes don't cause resolution jumps
+	double smoothedTime = 0.0;
+};
@@ -0,0 +1,45 @@
+#include <cstring>
+
+#include "ring.hpp"
+
+
+MappedRing::MappedRing(VulkanState &vulkan, vk::BufferUsageFlags usage, size_t frameCapacity):
+	frameCapacity(frameCapacity)
+{
+	size_t size = frameCapacity * MAX_FRAMES_IN_FLIGHT;
+	ringBuffer = vulkan.createBuffer(
+		usage,
+		size,
+		vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent
+	);
+	mapped = static_cast<uint8_t*>(vulkan.device->mapMemory(*ringBuffer.memory, 0, size, {}));
+}
+
+
+// Start writing to the region of the given frame
+void MappedRing::beginFrame(size_t frameIndex) {
+	frameStart = frameIndex * frameCapacity;
+	used = 0;
+}
+
+
+// Copy data into the current frame's region, returns the byte offset in the buffer
+std::optional<vk::DeviceSize> MappedRing::push(const void *data, size_t size, size_t alignment) {
+	size_t offset = (used + alignment - 1) / alignment * alignment;
+	if (offset + size > frameCapacity) {
+		return {};
+	}
+	memcpy(mapped + frameStart + offset, data, size);
+	used = offset + size;
+	return frameStart + offset;
+}
+
+
+vk::Buffer MappedRing::buffer() const {
+	return *ringBuffer.buffer;
+}
+
+
+vk::DeviceSize MappedRing::frameOffset(size_t frameIndex) const {
+	return frameIndex * frameCapacity;
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+// Persistently mapped buffer split into one region per in-flight frame
+// Data pushed during a frame stays untouched until the same frame index comes around again,
+// at which point its fence has been waited for and the region can be reused.
+
+#include <array>
+#include <cstdint>
+#include <optional>
+
+#include "vulkan.hpp"
+
+
+class MappedRing
+{
+public:
+	// Make a ring with frameCapacity bytes available to each in-flight frame
+	MappedRing(VulkanState &vulkan, vk::BufferUsageFlags usage, size_t frameCapacity);
+
+	// Start writing to the region of the given frame, discarding its previous contents
+	void beginFrame(size_t frameIndex);
+
+	// Copy data into the current frame's region
+	// Returns the byte offset in the buffer, or empty if the region is full
+	std::optional<vk::DeviceSize> push(const void *data, size_t size, size_t alignment);
+
+	vk::Buffer buffer() const;
+
+	// Byte offset of a frame's region in the buffer
+	vk::DeviceSize frameOffset(size_t frameIndex) const;
+
+private:
+	BufferAndMemory ringBuffer;
+	uint8_t *mapped;
+	size_t frameCapacity;
+	// Start of the current frame's region, and how far into it we've written
+	size_t frameStart = 0;
+	size_t used = 0;
+};
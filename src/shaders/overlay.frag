@@ -0,0 +1,47 @@
+#version 450
+
+layout(location = 0) in vec2 cell;
+layout(location = 1) flat in uint glyph;
+layout(location = 2) flat in vec4 color;
+
+layout(location = 0) out vec4 color_out;
+
+// Glyph of quads that are filled completely, for panels and bars, see OVERLAY_SOLID
+const uint SOLID = 0xffffffffu;
+
+// 5x7 pixel font from ' ' to 'Z', see OVERLAY_FIRST_GLYPH
+// Rows 0 to 3 are in the first word and rows 4 to 6 in the second, 5 bits per row with
+// the leftmost pixel in the highest bit
+const uvec2 FONT[59] = uvec2[](
+	uvec2(0x00000u, 0x0000u), uvec2(0x21084u, 0x1004u), uvec2(0x52800u, 0x0000u), uvec2(0x52beau, 0x7d4au), // space ! " #
+	uvec2(0x23e8eu, 0x17c4u), uvec2(0xc6444u, 0x2263u), uvec2(0x64a88u, 0x564du), uvec2(0x21000u, 0x0000u), // $ % & '
+	uvec2(0x11108u, 0x2082u), uvec2(0x41042u, 0x0888u), uvec2(0x012aeu, 0x5480u), uvec2(0x0109fu, 0x1080u), // ( ) * +
+	uvec2(0x00000u, 0x3088u), uvec2(0x0001fu, 0x0000u), uvec2(0x00000u, 0x018cu), uvec2(0x00444u, 0x2200u), // , - . /
+	uvec2(0x74675u, 0x662eu), uvec2(0x23084u, 0x108eu), uvec2(0x74422u, 0x111fu), uvec2(0xf8882u, 0x062eu), // 0 1 2 3
+	uvec2(0x11952u, 0x7c42u), uvec2(0xfc3c1u, 0x062eu), uvec2(0x3221eu, 0x462eu), uvec2(0xf8444u, 0x2108u), // 4 5 6 7
+	uvec2(0x7462eu, 0x462eu), uvec2(0x7462fu, 0x044cu), uvec2(0x03180u, 0x3180u), uvec2(0x03180u, 0x3088u), // 8 9 : ;
+	uvec2(0x11110u, 0x2082u), uvec2(0x003e0u, 0x7c00u), uvec2(0x41041u, 0x0888u), uvec2(0x74422u, 0x1004u), // < = > ?
+	uvec2(0x7442du, 0x56aeu), uvec2(0x7463fu, 0x4631u), uvec2(0xf463eu, 0x463eu), uvec2(0x74610u, 0x422eu), // @ A B C
+	uvec2(0xe4a31u, 0x465cu), uvec2(0xfc21eu, 0x421fu), uvec2(0xfc21eu, 0x4210u), uvec2(0x74617u, 0x462fu), // D E F G
+	uvec2(0x8c63fu, 0x4631u), uvec2(0x71084u, 0x108eu), uvec2(0x38842u, 0x0a4cu), uvec2(0x8ca98u, 0x5251u), // H I J K
+	uvec2(0x84210u, 0x421fu), uvec2(0x8eeb5u, 0x4631u), uvec2(0x8c735u, 0x4e31u), uvec2(0x74631u, 0x462eu), // L M N O
+	uvec2(0xf463eu, 0x4210u), uvec2(0x74631u, 0x564du), uvec2(0xf463eu, 0x5251u), uvec2(0x7c20eu, 0x043eu), // P Q R S
+	uvec2(0xf9084u, 0x1084u), uvec2(0x8c631u, 0x462eu), uvec2(0x8c631u, 0x4544u), uvec2(0x8c635u, 0x56aau), // T U V W
+	uvec2(0x8c544u, 0x2a31u), uvec2(0x8c544u, 0x1084u), uvec2(0xf8444u, 0x221fu) // X Y Z
+);
+
+void main() {
+	if (glyph != SOLID) {
+		// Glyph cells are 6x8 font pixels, leaving a pixel of spacing right and below
+		ivec2 pixel = ivec2(cell * vec2(6.0, 8.0));
+		if (pixel.x >= 5 || pixel.y >= 7) {
+			discard;
+		}
+		uvec2 bits = FONT[glyph];
+		uint row = pixel.y < 4 ? bits.x >> (5 * (3 - pixel.y)) : bits.y >> (5 * (6 - pixel.y));
+		if (((row >> (4 - pixel.x)) & 1u) == 0u) {
+			discard;
+		}
+	}
+	color_out = color;
+}
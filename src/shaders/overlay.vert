@@ -0,0 +1,31 @@
+#version 450
+
+// Quads of the stats overlay, an instance each, placed in pixels from the top left
+layout(location = 0) in vec2 position;
+layout(location = 1) in vec2 size;
+layout(location = 2) in uint glyph;
+layout(location = 3) in uint color;
+
+// Position inside the quad, 0 to 1
+layout(location = 0) out vec2 cell_out;
+layout(location = 1) flat out uint glyph_out;
+layout(location = 2) flat out vec4 color_out;
+
+layout(push_constant) uniform State {
+	// Overlay size in pixels
+	vec2 screenSize;
+} state;
+
+const vec2 CORNERS[6] = vec2[](
+	vec2(0.0, 0.0), vec2(1.0, 0.0), vec2(0.0, 1.0),
+	vec2(1.0, 0.0), vec2(1.0, 1.0), vec2(0.0, 1.0)
+);
+
+void main() {
+	vec2 corner = CORNERS[gl_VertexIndex];
+	vec2 pixel = position + corner * size;
+	gl_Position = vec4(pixel / state.screenSize * 2.0 - 1.0, 0.0, 1.0);
+	cell_out = corner;
+	glyph_out = glyph;
+	color_out = unpackUnorm4x8(color);
+}
@@ -4,7 +4,6 @@ layout(location = 0) out vec4 f_color;
 
 layout(push_constant) uniform State {
 	mat4 mvp;
-	float time;
 } state;
 
 
@@ -1,25 +1,41 @@
 #version 450
 
-layout(location = 0) in vec3 pos0;
-layout(location = 1) in vec3 v0;
+#ifdef MULTIVIEW
+#extension GL_EXT_multiview : require
+#extension GL_EXT_nonuniform_qualifier : require
+#endif
+
+// Position written by particle.comp, w is 0 for hidden particles
+layout(location = 0) in vec4 particle;
 
 layout(push_constant) uniform State {
 	mat4 mvp;
-	float time;
+#ifdef MULTIVIEW
+	// Index of the view matrices in the bindless buffer array, used instead of mvp
+	layout(offset = 96) uint viewBuffer;
+#endif
 } state;
 
-const float gravity = 1.0;
+#ifdef MULTIVIEW
+// View projection of every view drawn by the multiview render pass
+layout(set = 0, binding = 1) readonly buffer Views {
+	mat4 viewProjection[];
+} views[];
+#define VIEW_PROJECTION views[state.viewBuffer].viewProjection[gl_ViewIndex]
+#else
+#define VIEW_PROJECTION state.mvp
+#endif
+
+// Size of particles in pixels, see PARTICLE_POINT_SIZE
+layout(constant_id = 0) const float pointSize = 10.0;
 
 void main() {
-	// Particle position is calculated based on time and initial position and speed
-	vec3 pos = pos0 + v0 * state.time;
-	pos.y -= gravity * state.time * state.time;
-	if (pos.y >= 0) {
-		gl_Position = state.mvp * vec4(pos, 1.0);
-		gl_PointSize = 10;
+	if (particle.w > 0) {
+		gl_Position = VIEW_PROJECTION * vec4(particle.xyz, 1.0);
+		gl_PointSize = pointSize;
 	} else {
 		// Hide particle after it hit the ground
 		gl_Position = vec4(-100, -100, -100, 1.0);
 		gl_PointSize = 0;
 	}
-}
\ No newline at end of file
+}
@@ -11,9 +11,18 @@ layout(push_constant) uniform State {
 
 const vec3 LIGHT = normalize(vec3(1.0, -0.5, 0.7));
 
-const vec3 GROUND_BASE = vec3(20, 83, 10);
-const vec3 MOUNTAIN_BASE = vec3(74, 83, 90);
-const vec3 LAVA_BASE = vec3(190, 47, 0);
+// Palette as specialization constants, see TerrainPalette
+// Colours are 0xRRGGBB, radii are distances from the centre in texture coordinates
+layout(constant_id = 0) const uint GROUND_COLOR = 0x14530au;
+layout(constant_id = 1) const uint MOUNTAIN_COLOR = 0x4a535au;
+layout(constant_id = 2) const uint LAVA_COLOR = 0xbe2f00u;
+layout(constant_id = 3) const float LAVA_RADIUS = 0.17;
+layout(constant_id = 4) const float MOUNTAIN_RADIUS = 0.27;
+
+// Folded to a constant when the pipeline is made
+vec3 unpackColor(uint color) {
+	return vec3((color >> 16) & 0xffu, (color >> 8) & 0xffu, color & 0xffu);
+}
 
 // Instead of sampling a texture we'll choose between three colours
 // based on distance from the centre.
@@ -23,15 +32,15 @@ vec4 gen_texture(vec2 position) {
 	// Perturb the distance a bit to get nice wavy lines
 	dist += cos(atan(c.x, c.y)*10) / 200;
 	dist += cos(atan(c.x, c.y)*3 ) / 100;
-	if (dist < .17) {
-		vec4 col = vec4(LAVA_BASE, 255) / 255;
+	if (dist < LAVA_RADIUS) {
+		vec4 col = vec4(unpackColor(LAVA_COLOR), 255) / 255;
 		// Make lava brighter towards the centre
-		col.rg /= (dist / .17);
+		col.rg /= (dist / LAVA_RADIUS);
 		return col;
-	} else if (dist > 0.27) {
-		return vec4(GROUND_BASE, 255) / 255;
+	} else if (dist > MOUNTAIN_RADIUS) {
+		return vec4(unpackColor(GROUND_COLOR), 255) / 255;
 	} else {
-		return vec4(MOUNTAIN_BASE, 255) / 255;
+		return vec4(unpackColor(MOUNTAIN_COLOR), 255) / 255;
 	}
 }
 
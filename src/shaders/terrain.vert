@@ -1,18 +1,99 @@
 #version 450
 
+#if defined(HEIGHTMAP) || defined(MULTIVIEW)
+#extension GL_EXT_nonuniform_qualifier : require
+#endif
+#ifdef MULTIVIEW
+#extension GL_EXT_multiview : require
+#endif
+
+#ifdef HEIGHTMAP
+// Vertices are pulled from a height map image in the bindless heap, so the
+// per instance model transform is the only vertex input, taking locations 0 to 3
+layout(location = 0) in mat4 model;
+
+layout(set = 0, binding = 0) uniform sampler2D images[];
+#else
 layout(location = 0) in vec3 pos;
 layout(location = 1) in vec3 normal;
 layout(location = 2) in vec2 tex;
+// Per instance model transform, takes locations 3 to 6
+layout(location = 3) in mat4 model;
+#endif
     
 layout(location = 0) out vec3 normal_out;
 layout(location = 1) out vec2 tex_out;
 
 layout(push_constant) uniform State {
-	mat4 mvp;
+	mat4 viewProjection;
+#ifdef HEIGHTMAP
+	// Index of the height map in the bindless image array, and its width and height in samples
+	uint heightmap;
+	uint mapSize;
+#endif
+#ifdef MULTIVIEW
+	// Index of the view matrices in the bindless buffer array, used instead of viewProjection
+	layout(offset = 96) uint viewBuffer;
+#endif
 } state;
 
+#ifdef MULTIVIEW
+// View projection of every view drawn by the multiview render pass
+layout(set = 0, binding = 1) readonly buffer Views {
+	mat4 viewProjection[];
+} views[];
+#define VIEW_PROJECTION views[state.viewBuffer].viewProjection[gl_ViewIndex]
+#else
+#define VIEW_PROJECTION state.viewProjection
+#endif
+
+// Must match terrain_depth.vert exactly for the equal depth test after a pre-pass
+invariant gl_Position;
+
+#ifdef HEIGHTMAP
+// Cells along each side of a grid patch at most, see TERRAIN_GRID_PATCH_CELLS
+const int GRID_PATCH_CELLS = 255;
+
+float height(ivec2 texel) {
+	texel = clamp(texel, ivec2(0), ivec2(state.mapSize - 1));
+	return texelFetch(images[state.heightmap], texel, 0).r;
+}
+#endif
+
 void main() {
-	gl_Position = state.mvp * vec4(pos, 1.0);
-	normal_out = normal;
+#ifdef HEIGHTMAP
+	// Drawn as grid patches sharing one index buffer, the vertex offset of each draw is the
+	// patch times its samples. Patches past the map edge are clamped to it, into empty triangles.
+	int cells = int(state.mapSize) - 1;
+	int patchCells = min(cells, GRID_PATCH_CELLS);
+	int patchSamples = (patchCells + 1) * (patchCells + 1);
+	int patchesPerRow = (cells + patchCells - 1) / patchCells;
+	int patchIndex = gl_VertexIndex / patchSamples;
+	int sampleIndex = gl_VertexIndex % patchSamples;
+	ivec2 texel = (
+		ivec2(patchIndex % patchesPerRow, patchIndex / patchesPerRow) * patchCells +
+		ivec2(sampleIndex % (patchCells + 1), sampleIndex / (patchCells + 1))
+	);
+	texel = min(texel, ivec2(cells));
+
+	vec2 tex = vec2(texel) / float(state.mapSize);
+	vec3 pos = vec3(tex.x - 0.5, height(texel), tex.y - 0.5);
+
+	// Central differences, edges fall back to one sided differences scaled up like the CPU mesh
+	float dx = height(texel + ivec2(1, 0)) - height(texel - ivec2(1, 0));
+	float dy = height(texel + ivec2(0, 1)) - height(texel - ivec2(0, 1));
+	int last = int(state.mapSize) - 1;
+	if (texel.x == 0 || texel.x == last) {
+		dx *= 2.0;
+	}
+	if (texel.y == 0 || texel.y == last) {
+		dy *= 2.0;
+	}
+	vec3 normal = normalize(vec3(2.0 * dx, -4.0, 2.0 * dy));
+#endif
+
+	gl_Position = VIEW_PROJECTION * (model * vec4(pos, 1.0));
+	// Instances are only translated and rotated, so no need for the inverse transpose
+	normal_out = mat3(model) * normal;
 	tex_out = tex;
-}
\ No newline at end of file
+}
@@ -0,0 +1,36 @@
+#version 450
+
+#ifdef MULTIVIEW
+#extension GL_EXT_multiview : require
+#extension GL_EXT_nonuniform_qualifier : require
+#endif
+
+// Depth only version of terrain.vert, reading just the packed position stream
+
+layout(location = 0) in vec3 pos;
+layout(location = 1) in mat4 model;
+
+layout(push_constant) uniform State {
+	mat4 viewProjection;
+#ifdef MULTIVIEW
+	// Index of the view matrices in the bindless buffer array, used instead of viewProjection
+	layout(offset = 96) uint viewBuffer;
+#endif
+} state;
+
+#ifdef MULTIVIEW
+// View projection of every view drawn by the multiview render pass
+layout(set = 0, binding = 1) readonly buffer Views {
+	mat4 viewProjection[];
+} views[];
+#define VIEW_PROJECTION views[state.viewBuffer].viewProjection[gl_ViewIndex]
+#else
+#define VIEW_PROJECTION state.viewProjection
+#endif
+
+// Must match terrain.vert exactly for the equal depth test of the main pass
+invariant gl_Position;
+
+void main() {
+	gl_Position = VIEW_PROJECTION * (model * vec4(pos, 1.0));
+}
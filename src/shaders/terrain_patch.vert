@@ -0,0 +1,44 @@
+#version 450
+#extension GL_EXT_nonuniform_qualifier : require
+
+// Corners of coarse terrain patches for the tessellation stages, pulled from the height map
+// like terrain_heightmap.vert. Corners are passed on in world space for measuring edges.
+
+// Per instance model transform, takes locations 0 to 3
+layout(location = 0) in mat4 model;
+
+layout(set = 0, binding = 0) uniform sampler2D images[];
+
+layout(location = 0) out vec2 tex_out;
+layout(location = 1) out mat4 model_out;
+
+layout(push_constant) uniform State {
+	mat4 viewProjection;
+	uint heightmap;
+	uint mapSize;
+	vec2 viewportSize;
+	float edgePixels;
+	uint patchesPerSide;
+} state;
+
+// Must match TERRAIN_PATCH_SAMPLES
+const int PATCH_SAMPLES = 8;
+
+// Corners of each patch, in the order the evaluation shader interpolates them
+const ivec2 PATCH_CORNERS[4] = ivec2[](
+	ivec2(0, 0), ivec2(1, 0), ivec2(0, 1), ivec2(1, 1)
+);
+
+void main() {
+	int patchesPerSide = int(state.patchesPerSide);
+	int patchIndex = gl_VertexIndex / 4;
+	ivec2 patchPosition = ivec2(patchIndex % patchesPerSide, patchIndex / patchesPerSide);
+	// Last row and column of patches may be cut short by the edge of the map
+	ivec2 texel = min((patchPosition + PATCH_CORNERS[gl_VertexIndex % 4]) * PATCH_SAMPLES, ivec2(state.mapSize - 1));
+
+	vec2 tex = vec2(texel) / float(state.mapSize);
+	float height = texelFetch(images[state.heightmap], texel, 0).r;
+	gl_Position = model * vec4(tex.x - 0.5, height, tex.y - 0.5, 1.0);
+	tex_out = tex;
+	model_out = model;
+}
@@ -0,0 +1,196 @@
+#pragma once
+
+// Runtime statistics of the renderer
+// Counters are plain fields bumped while recording, timings go into fixed size rolling
+// windows, so keeping statistics costs next to nothing per frame.
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+#include <vulkan/vulkan.hpp>
+
+
+// Frames kept in the rolling timing windows
+static const size_t STATS_WINDOW = 120;
+
+
+// Last samples of a value, oldest ones are overwritten
+template<size_t Size>
+class RollingSamples
+{
+public:
+	void add(float value) {
+		samples[next] = value;
+		next = (next + 1) % Size;
+		count = std::min(count + 1, Size);
+	}
+
+	// Number of samples held, up to Size
+	size_t size() const {
+		return count;
+	}
+
+	// Sample by age, 0 is the most recent
+	float at(size_t age) const {
+		return samples[(next + Size - 1 - age) % Size];
+	}
+
+	float last() const {
+		return count > 0 ? at(0) : 0.0f;
+	}
+
+	float average() const {
+		float sum = 0.0f;
+		for (size_t i = 0; i < count; i++) {
+			sum += samples[i];
+		}
+		return count > 0 ? sum / count : 0.0f;
+	}
+
+	float max() const {
+		float result = 0.0f;
+		for (size_t i = 0; i < count; i++) {
+			result = std::max(result, samples[i]);
+		}
+		return result;
+	}
+
+	// Count samples into equally sized bins from 0 to upper, larger samples go in the last bin
+	template<size_t Bins>
+	std::array<uint32_t, Bins> histogram(float upper) const {
+		std::array<uint32_t, Bins> bins{};
+		for (size_t i = 0; i < count; i++) {
+			size_t bin = upper > 0.0f ? (size_t) (samples[i] / upper * Bins) : 0;
+			bins[std::min(bin, Bins - 1)]++;
+		}
+		return bins;
+	}
+
+private:
+	std::array<float, Size> samples{};
+	size_t next = 0;
+	size_t count = 0;
+};
+
+
+// Bytes and allocations currently taken from each memory heap
+// Atomic since loader threads allocate too
+struct HeapCounters {
+	std::array<std::atomic<vk::DeviceSize>, VK_MAX_MEMORY_HEAPS> bytes{};
+	std::array<std::atomic<uint32_t>, VK_MAX_MEMORY_HEAPS> allocations{};
+};
+
+
+// Keeps a device memory allocation counted in its heap for as long as it is held
+// Lives next to the memory handle and moves along with it
+class HeapAllocation
+{
+public:
+	HeapAllocation() = default;
+
+	HeapAllocation(HeapCounters &counters, uint32_t heap, vk::DeviceSize size):
+		counters(&counters), heap(heap), size(size)
+	{
+		counters.bytes[heap] += size;
+		counters.allocations[heap]++;
+	}
+
+	HeapAllocation(HeapAllocation &&other) noexcept {
+		*this = std::move(other);
+	}
+
+	HeapAllocation &operator=(HeapAllocation &&other) noexcept {
+		if (this != &other) {
+			reset();
+			counters = other.counters;
+			heap = other.heap;
+			size = other.size;
+			other.counters = nullptr;
+		}
+		return *this;
+	}
+
+	HeapAllocation(const HeapAllocation&) = delete;
+	HeapAllocation &operator=(const HeapAllocation&) = delete;
+
+	~HeapAllocation() {
+		reset();
+	}
+
+	// Heap the allocation is counted in
+	uint32_t heapIndex() const {
+		return heap;
+	}
+
+	// Size of the allocation, 0 if nothing is counted
+	vk::DeviceSize bytes() const {
+		return counters ? size : 0;
+	}
+
+	// Stop counting the allocation, call when freeing the memory
+	void reset() {
+		if (counters) {
+			counters->bytes[heap] -= size;
+			counters->allocations[heap]--;
+			counters = nullptr;
+		}
+	}
+
+private:
+	HeapCounters *counters = nullptr;
+	uint32_t heap = 0;
+	vk::DeviceSize size = 0;
+};
+
+
+// Usage of one memory heap, see VulkanState::heapStats
+struct HeapStats {
+	vk::DeviceSize size;
+	// Bytes and allocations made through VulkanState
+	vk::DeviceSize used;
+	uint32_t allocations;
+	// Memory the process may use and uses in total, including driver internal allocations
+	// when the device reports budgets, otherwise the heap size and our own usage
+	vk::DeviceSize budget;
+	vk::DeviceSize usage;
+	bool deviceLocal;
+};
+
+
+// Work recorded for one frame
+struct FrameCounters {
+	uint32_t draws = 0;
+	// Triangles submitted, before any tessellation
+	uint64_t triangles = 0;
+	// Live particles, as counted by a simulation a few frames back
+	uint32_t particles = 0;
+	// Render graph passes recorded and culled, and image barriers it put between them
+	uint32_t passes = 0;
+	uint32_t culledPasses = 0;
+	uint32_t barriers = 0;
+};
+
+
+// Statistics of the running renderer, kept up to date by VulkanState
+// Draw counts are added by whoever records the draws, with countDraw
+struct RendererStats {
+	// Counters of the frame being recorded, and of the last fully recorded one
+	FrameCounters current{};
+	FrameCounters last{};
+	uint64_t frames = 0;
+	uint32_t swapchainRecreations = 0;
+
+	// Milliseconds per frame on the CPU, on the GPU, and spent waiting for frame fences
+	RollingSamples<STATS_WINDOW> cpuFrameTime{};
+	RollingSamples<STATS_WINDOW> gpuFrameTime{};
+	RollingSamples<STATS_WINDOW> fenceWaitTime{};
+
+	// Count a draw and the triangles it submits
+	void countDraw(uint64_t triangles) {
+		current.draws++;
+		current.triangles += triangles;
+	}
+};
@@ -1,5 +1,5 @@
-
 #include <algorithm>
+#include <array>
 #include <cmath>
 #include <cstdint>
 #include <vector>
@@ -7,18 +7,16 @@
 #include <glm/glm.hpp>
 
 #include "terrain.hpp"
-
-// Dimensions of height map
-const size_t MAP_SIZE = 32;
+#include "util.h"
 
 
-// Make a MAP_SIZE x MAP_SIZE height map with elevation between 0 and 1
-static std::vector<float> generateHeightmap() {
+// Make a size x size height map with elevation between 0 and 1
+static std::vector<float> generateHeightmap(size_t size) {
 	std::vector<float> map{};
-	map.reserve(MAP_SIZE*MAP_SIZE);
-	float half = MAP_SIZE / 2;
-	for (size_t y = 0; y < MAP_SIZE; y++) {
-		for (size_t x = 0; x < MAP_SIZE; x++) {
+	map.reserve(size*size);
+	float half = size / 2;
+	for (size_t y = 0; y < size; y++) {
+		for (size_t x = 0; x < size; x++) {
 			float xc = (x - half) / half;
 			float yc = (y - half) / half;
 			float height = std::max(0.0f, sinf(std::min(3.14f, sqrtf((xc*xc) + (yc*yc)) * 6)));
@@ -29,74 +27,387 @@ static std::vector<float> generateHeightmap() {
 }
 
 
-// Convert the height map to vertices with a calculated normal
-static std::vector<Vertex> makeVertices(std::vector<float> &heights) {
-	std::vector<Vertex> vertices{};
-	// This is silly, should probably just store heights in proper structure
-	auto lookup = [&](int x, int y) { return heights.at(y*MAP_SIZE + x);};
-	const size_t lastRow = MAP_SIZE - 1;
-	for (size_t y = 0; y < MAP_SIZE; y++) {
-		for (size_t x = 0; x < MAP_SIZE; x++) {
-			float height = lookup(x, y);
-			float dx, dy;
-			if (x == 0) {
-				dx = (lookup(x+1, y) - lookup(x, y)) * 2;
-			} else if (x == lastRow) {
-				dx = (lookup(x, y) - lookup (x-1, y)) * 2;
-			} else {
-				dx = lookup(x+1, y) - lookup(x-1, y);
-			}
-			if (y == 0) {
-				dy = (lookup(x, y+1) - lookup(x, y)) * 2;
-			} else if (y == lastRow) {
-				dy = (lookup(x, y) - lookup(x, y-1)) * 2;
-			} else {
-				dy = lookup(x, y+1) - lookup(x, y-1);
-			}
-			glm::vec3 pos {
-				x / (float) MAP_SIZE - 0.5,
-				height,
-				y / (float) MAP_SIZE - 0.5,
-			};
-			glm::vec3 normal{ 2.0 * dx, -4.0, 2.0 * dy };
-			glm::vec2 texCoord{ x / (float) MAP_SIZE, y / (float) MAP_SIZE};
-			vertices.push_back({
-				pos,
-				glm::normalize(normal),
-				texCoord
-			});
+// Make indices for the cells of a grid patch with the given number of samples along each side
+static std::vector<uint16_t> makePatchIndices(size_t size) {
+	std::vector<uint16_t> indices;
+	for (size_t y = 0; y < size - 1; y++) {
+		for (size_t x = 0; x < size - 1; x++) {
+			// Same triangles as makeIndices
+			uint16_t i = y * size + x;
+			indices.push_back(i);
+			indices.push_back(i + 1);
+			indices.push_back(i + size);
+			indices.push_back(i + 1);
+			indices.push_back(i + 1 + size);
+			indices.push_back(i + size);
 		}
 	}
-	return vertices;
+	return indices;
 }
 
 
 // Make indices to draw a solid mesh over the ground vertex
-static std::vector<uint32_t> makeIndices() {
+static std::vector<uint32_t> makeIndices(size_t size) {
 	std::vector<uint32_t> indices;
-	for (size_t y = 0; y < MAP_SIZE - 1; y++) {
-		for (size_t x = 0; x < MAP_SIZE - 1; x++) {
+	for (size_t y = 0; y < size - 1; y++) {
+		for (size_t x = 0; x < size - 1; x++) {
 			// Make two triangles between each 2x2 pixel group
-			uint32_t i = y * MAP_SIZE + x;
+			uint32_t i = y * size + x;
 			indices.push_back(i);
 			indices.push_back(i + 1);
-			indices.push_back(i + MAP_SIZE);
+			indices.push_back(i + size);
 			indices.push_back(i + 1);
-			indices.push_back(i + 1 + MAP_SIZE);
-			indices.push_back(i + MAP_SIZE);
+			indices.push_back(i + 1 + size);
+			indices.push_back(i + size);
 		}
 	}
 	return indices;
 }
 
 
-// Make terrain model
-Model makeTerrainModel() {
-	auto heights = generateHeightmap();
-	auto vertices = makeVertices(heights);
-	auto indices = makeIndices();
+Terrain::Terrain(size_t size, bool heightsOnly):
+	mapSize(size),
+	heightsOnly(heightsOnly),
+	heights(generateHeightmap(size))
+{
+	if (!heightsOnly) {
+		vertices.resize(mapSize * mapSize);
+		update({0, 0, mapSize, mapSize});
+	}
+	// Nothing uploaded yet, the first upload is the whole model
+	dirtyRegion.reset();
+}
+
+
+// Full model, for uploading or caching
+Model Terrain::model() const {
+	assertThat((!heightsOnly), "Terrain with heights only has no model\n");
 	return {
 		vertices,
-		indices
+		makeIndices(mapSize)
+	};
+}
+
+
+// Make the vertex for a sample with a normal calculated from its neighbours
+Vertex Terrain::makeVertex(size_t x, size_t y) const {
+	auto lookup = [&](size_t x, size_t y) { return heights.at(y*mapSize + x);};
+	const size_t lastRow = mapSize - 1;
+	float height = lookup(x, y);
+	float dx, dy;
+	if (x == 0) {
+		dx = (lookup(x+1, y) - lookup(x, y)) * 2;
+	} else if (x == lastRow) {
+		dx = (lookup(x, y) - lookup (x-1, y)) * 2;
+	} else {
+		dx = lookup(x+1, y) - lookup(x-1, y);
+	}
+	if (y == 0) {
+		dy = (lookup(x, y+1) - lookup(x, y)) * 2;
+	} else if (y == lastRow) {
+		dy = (lookup(x, y) - lookup(x, y-1)) * 2;
+	} else {
+		dy = lookup(x, y+1) - lookup(x, y-1);
+	}
+	glm::vec3 pos {
+		x / (float) mapSize - 0.5,
+		height,
+		y / (float) mapSize - 0.5,
+	};
+	glm::vec3 normal{ 2.0 * dx, -4.0, 2.0 * dy };
+	glm::vec2 texCoord{ x / (float) mapSize, y / (float) mapSize};
+	return {
+		pos,
+		glm::normalize(normal),
+		texCoord
+	};
+}
+
+
+// Recompute vertices for a region if there are any, and add it to the dirty region
+void Terrain::update(TerrainRegion region) {
+	if (!heightsOnly) {
+		for (size_t y = region.y0; y < region.y1; y++) {
+			for (size_t x = region.x0; x < region.x1; x++) {
+				vertices.at(y*mapSize + x) = makeVertex(x, y);
+			}
+		}
+	}
+	if (dirtyRegion) {
+		dirtyRegion->x0 = std::min(dirtyRegion->x0, region.x0);
+		dirtyRegion->y0 = std::min(dirtyRegion->y0, region.y0);
+		dirtyRegion->x1 = std::max(dirtyRegion->x1, region.x1);
+		dirtyRegion->y1 = std::max(dirtyRegion->y1, region.y1);
+	} else {
+		dirtyRegion = region;
+	}
+}
+
+
+// Set heights in a region and recompute the vertices around it
+void Terrain::edit(TerrainRegion region, const std::function<float(size_t x, size_t y, float height)> &edit) {
+	region.x1 = std::min(region.x1, mapSize);
+	region.y1 = std::min(region.y1, mapSize);
+	if (region.x0 >= region.x1 || region.y0 >= region.y1) {
+		return;
+	}
+	for (size_t y = region.y0; y < region.y1; y++) {
+		for (size_t x = region.x0; x < region.x1; x++) {
+			float &height = heights.at(y*mapSize + x);
+			height = edit(x, y, height);
+		}
+	}
+	// Normals of the neighbouring samples change too
+	update({
+		region.x0 > 0 ? region.x0 - 1 : 0,
+		region.y0 > 0 ? region.y0 - 1 : 0,
+		std::min(region.x1 + 1, mapSize),
+		std::min(region.y1 + 1, mapSize),
+	});
+}
+
+
+// Raise terrain around a point in model space with a smooth falloff
+void Terrain::brush(glm::vec2 center, float radius, float strength) {
+	// Same mapping from samples to model space as the vertex positions
+	glm::vec2 sample = (center + 0.5f) * (float) mapSize;
+	float sampleRadius = radius * mapSize;
+	auto toSample = [&](float value) {
+		return (size_t) std::clamp(value, 0.0f, (float) mapSize);
+	};
+	TerrainRegion region {
+		toSample(floorf(sample.x - sampleRadius)),
+		toSample(floorf(sample.y - sampleRadius)),
+		toSample(ceilf(sample.x + sampleRadius) + 1),
+		toSample(ceilf(sample.y + sampleRadius) + 1),
+	};
+	edit(region, [&](size_t x, size_t y, float height) {
+		float distance = glm::length(glm::vec2(x, y) - sample) / sampleRadius;
+		float falloff = std::max(0.0f, 1.0f - distance * distance);
+		return height + strength * falloff * falloff;
+	});
+}
+
+
+// Mark all vertices as changed
+void Terrain::invalidate() {
+	dirtyRegion = TerrainRegion{0, 0, mapSize, mapSize};
+}
+
+
+// Record copies of the changed vertices from the staging ring into the model's buffers
+void Terrain::recordUpload(vk::CommandBuffer commandBuffer, MappedRing &staging, const UploadedModel &model) {
+	assertThat((!heightsOnly), "Terrain with heights only has no vertices to upload\n");
+	if (!dirtyRegion) {
+		return;
+	}
+	auto &region = *dirtyRegion;
+	size_t rowLength = region.x1 - region.x0;
+	std::vector<glm::vec3> rowPositions(rowLength);
+	std::vector<vk::BufferCopy> vertexCopies{};
+	std::vector<vk::BufferCopy> positionCopies{};
+
+	// Each row of the region is a contiguous range in both buffers
+	size_t y = region.y0;
+	for (; y < region.y1; y++) {
+		size_t first = y * mapSize + region.x0;
+		for (size_t i = 0; i < rowLength; i++) {
+			rowPositions[i] = vertices[first + i].pos;
+		}
+		auto vertexOffset = staging.push(&vertices[first], rowLength * sizeof(Vertex), sizeof(float));
+		auto positionOffset = staging.push(rowPositions.data(), rowLength * sizeof(glm::vec3), sizeof(float));
+		if (!vertexOffset || !positionOffset) {
+			break;
+		}
+		vertexCopies.push_back({*vertexOffset, first * sizeof(Vertex), rowLength * sizeof(Vertex)});
+		positionCopies.push_back({*positionOffset, first * sizeof(glm::vec3), rowLength * sizeof(glm::vec3)});
+	}
+	if (vertexCopies.empty()) {
+		return;
+	}
+
+	// Frames in flight may still be reading the old vertices
+	commandBuffer.pipelineBarrier(
+		vk::PipelineStageFlagBits::eVertexInput,
+		vk::PipelineStageFlagBits::eTransfer,
+		{}, nullptr, nullptr, nullptr
+	);
+
+	commandBuffer.copyBuffer(staging.buffer(), *model.vertices.buffer, vertexCopies);
+	commandBuffer.copyBuffer(staging.buffer(), *model.positions.buffer, positionCopies);
+
+	std::array<vk::BufferMemoryBarrier, 2> barriers{};
+	for (auto &barrier: barriers) {
+		barrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+		barrier.dstAccessMask = vk::AccessFlagBits::eVertexAttributeRead;
+		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.offset = 0;
+		barrier.size = VK_WHOLE_SIZE;
+	}
+	barriers[0].buffer = *model.vertices.buffer;
+	barriers[1].buffer = *model.positions.buffer;
+	commandBuffer.pipelineBarrier(
+		vk::PipelineStageFlagBits::eTransfer,
+		vk::PipelineStageFlagBits::eVertexInput,
+		{}, nullptr, barriers, nullptr
+	);
+
+	// Whatever didn't fit goes next frame
+	region.y0 = y;
+	if (region.y0 == region.y1) {
+		dirtyRegion.reset();
+	}
+}
+
+
+// Same for the heights of a height map image of the same size
+void Terrain::recordUpload(vk::CommandBuffer commandBuffer, MappedRing &staging, HeightmapTexture &texture) {
+	if (!dirtyRegion) {
+		return;
+	}
+	auto &region = *dirtyRegion;
+	size_t rowLength = region.x1 - region.x0;
+	std::vector<vk::BufferImageCopy> copies{};
+
+	size_t y = region.y0;
+	for (; y < region.y1; y++) {
+		auto offset = staging.push(&heights[y * mapSize + region.x0], rowLength * sizeof(float), sizeof(float));
+		if (!offset) {
+			break;
+		}
+		vk::BufferImageCopy copy{};
+		copy.bufferOffset = *offset;
+		copy.imageSubresource = vk::ImageSubresourceLayers{vk::ImageAspectFlagBits::eColor, 0, 0, 1};
+		copy.imageOffset = vk::Offset3D(region.x0, y, 0);
+		copy.imageExtent = vk::Extent3D(rowLength, 1, 1);
+		copies.push_back(copy);
+	}
+	if (copies.empty()) {
+		return;
+	}
+
+	// Frames in flight may still be reading the old heights, the rest of the image is kept
+	vk::ImageMemoryBarrier toTransfer{};
+	toTransfer.srcAccessMask = {};
+	toTransfer.dstAccessMask = vk::AccessFlagBits::eTransferWrite;
+	toTransfer.oldLayout = texture.initialized ? vk::ImageLayout::eShaderReadOnlyOptimal : vk::ImageLayout::eUndefined;
+	toTransfer.newLayout = vk::ImageLayout::eTransferDstOptimal;
+	toTransfer.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	toTransfer.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	toTransfer.image = *texture.image.image;
+	toTransfer.subresourceRange = vk::ImageSubresourceRange{vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1};
+	commandBuffer.pipelineBarrier(
+		texture.readStages,
+		vk::PipelineStageFlagBits::eTransfer,
+		{}, nullptr, nullptr, toTransfer
+	);
+
+	commandBuffer.copyBufferToImage(staging.buffer(), *texture.image.image, vk::ImageLayout::eTransferDstOptimal, copies);
+
+	vk::ImageMemoryBarrier toShader = toTransfer;
+	toShader.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+	toShader.dstAccessMask = vk::AccessFlagBits::eShaderRead;
+	toShader.oldLayout = vk::ImageLayout::eTransferDstOptimal;
+	toShader.newLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
+	commandBuffer.pipelineBarrier(
+		vk::PipelineStageFlagBits::eTransfer,
+		texture.readStages,
+		{}, nullptr, nullptr, toShader
+	);
+	texture.initialized = true;
+
+	// Whatever didn't fit goes next frame
+	region.y0 = y;
+	if (region.y0 == region.y1) {
+		dirtyRegion.reset();
+		// A new texture starts with the whole terrain invalidated, so every sample was written now
+		texture.ready = true;
+	}
+}
+
+
+// Make a size x size height map image, requires bindless support
+HeightmapTexture HeightmapTexture::create(VulkanState &vulkan, size_t size, bool tessellated) {
+	assertThat(vulkan.bindless, "Height map terrain requires descriptor indexing support\n");
+	HeightmapTexture texture{};
+	texture.size = size;
+	// Tessellated terrain displaces the refined vertices in the evaluation shader
+	texture.readStages = vk::PipelineStageFlagBits::eVertexShader;
+	if (tessellated) {
+		texture.readStages |= vk::PipelineStageFlagBits::eTessellationEvaluationShader;
+	}
+	texture.image = vulkan.createImage(
+		vk::Format::eR32Sfloat,
+		vk::Extent2D(size, size),
+		vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eTransferDst,
+		vk::ImageAspectFlagBits::eColor
+	);
+
+	// Heights are read with texelFetch, so the sampler never filters
+	vk::SamplerCreateInfo samplerInfo{};
+	samplerInfo.magFilter = vk::Filter::eNearest;
+	samplerInfo.minFilter = vk::Filter::eNearest;
+	samplerInfo.addressModeU = vk::SamplerAddressMode::eClampToEdge;
+	samplerInfo.addressModeV = vk::SamplerAddressMode::eClampToEdge;
+	samplerInfo.addressModeW = vk::SamplerAddressMode::eClampToEdge;
+	texture.sampler = vulkan.device->createSamplerUnique(samplerInfo);
+
+	texture.bindlessIndex = vulkan.bindless->addImage(*texture.image.view, *texture.sampler);
+
+	if (!tessellated) {
+		auto indices = makePatchIndices(texture.gridPatchCells() + 1);
+		texture.patchIndexCount = indices.size();
+		texture.patchIndices = vulkan.createBufferWithData(
+			vk::BufferUsageFlagBits::eIndexBuffer,
+			indices.size() * sizeof(uint16_t),
+			reinterpret_cast<uint8_t*>(indices.data())
+		);
+	}
+	return texture;
+}
+
+
+// Record an instanced draw of the grid with terrain_heightmap.vert
+void HeightmapTexture::draw(
+	vk::CommandBuffer commandBuffer,
+	vk::PipelineLayout layout,
+	vk::Buffer transforms,
+	vk::DeviceSize transformOffset,
+	uint32_t instanceCount
+) const {
+	HeightmapPushConstants constants{bindlessIndex, size, glm::vec2{0.0f}, 0.0f, 0};
+	commandBuffer.pushConstants(layout, PUSH_CONSTANT_STAGES, sizeof(glm::mat4), sizeof(constants), &constants);
+	commandBuffer.bindVertexBuffers(1, transforms, transformOffset);
+	// No vertex buffer, the vertex offset picks the patch and the shader finds the sample from it
+	assertThat(patchIndices.buffer, "Grid patch indices are only made for terrain without tessellation\n");
+	commandBuffer.bindIndexBuffer(*patchIndices.buffer, 0, vk::IndexType::eUint16);
+	int32_t patchVertices = (gridPatchCells() + 1) * (gridPatchCells() + 1);
+	uint32_t patches = gridPatchesPerSide() * gridPatchesPerSide();
+	for (uint32_t patch = 0; patch < patches; patch++) {
+		commandBuffer.drawIndexed(patchIndexCount, instanceCount, 0, patch * patchVertices, 0);
+	}
+}
+
+
+// Record an instanced draw of coarse patches for the tessellation stages
+void HeightmapTexture::drawPatches(
+	vk::CommandBuffer commandBuffer,
+	vk::PipelineLayout layout,
+	vk::Buffer transforms,
+	vk::DeviceSize transformOffset,
+	uint32_t instanceCount,
+	vk::Extent2D renderExtent
+) const {
+	HeightmapPushConstants constants{
+		bindlessIndex,
+		size,
+		glm::vec2(renderExtent.width, renderExtent.height),
+		TERRAIN_EDGE_PIXELS,
+		patchesPerSide(),
 	};
-}
\ No newline at end of file
+	commandBuffer.pushConstants(layout, PUSH_CONSTANT_STAGES, sizeof(glm::mat4), sizeof(constants), &constants);
+	commandBuffer.bindVertexBuffers(1, transforms, transformOffset);
+	// Patch corners are pulled from the height map too
+	commandBuffer.draw(patchesPerSide() * patchesPerSide() * TERRAIN_PATCH_CORNERS, instanceCount, 0, 0);
+}
@@ -1,6 +1,198 @@
 #pragma once
 
+// Terrain generated from a height map
+// The height map can be edited while the terrain is drawn, only vertices around the edited
+// region are recomputed and copied to the uploaded model.
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <vector>
+
+#include <glm/glm.hpp>
+
 #include "model.hpp"
+#include "ring.hpp"
+
+// Dimensions of the generated height map
+const size_t MAP_SIZE = 32;
+
+// Tessellated terrain is drawn as quad patches of this many samples along each side,
+// must match terrain_patch.vert
+const uint32_t TERRAIN_PATCH_SAMPLES = 8;
+const uint32_t TERRAIN_PATCH_CORNERS = 4;
+
+// Target length of tessellated triangle edges on screen, in pixels
+const float TERRAIN_EDGE_PIXELS = 12.0;
+
+// Height map terrain without tessellation is drawn as square grid patches of up to this many
+// cells along each side, so one patch of 16 bit indices serves any map size. Must match terrain.vert
+const uint32_t TERRAIN_GRID_PATCH_CELLS = 255;
+
+
+// Height map as an R32F image in the bindless heap, for drawing the terrain without vertex buffers
+// The vertex shader rebuilds positions and normals from the heights, for 4 bytes per sample
+// instead of a vertex, a packed position and six indices. Only the indices of one grid patch
+// are stored, and reused for every patch, so samples shared by neighbouring cells of a patch
+// are still shaded once.
+struct HeightmapTexture {
+	ImageAndMemory image;
+	vk::UniqueSampler sampler;
+	// Two triangles per cell of a grid patch, indexing its samples row by row
+	// Empty for tessellated terrain, which draws coarse patches without indices
+	BufferAndMemory patchIndices;
+	uint32_t patchIndexCount = 0;
+	uint32_t size;
+	uint32_t bindlessIndex;
+	// Shader stages that read the heights, uploads wait for them and are made visible to them
+	vk::PipelineStageFlags readStages;
+	// Whether the image has been written and is in shader read layout
+	bool initialized = false;
+	// Whether every sample has been written, large maps take several frames to go through the staging ring
+	bool ready = false;
+
+	// Make a size x size height map image, requires bindless support
+	// Invalidate the terrain so the next uploads write all of it
+	static HeightmapTexture create(VulkanState &vulkan, size_t size, bool tessellated);
+
+	// Record an instanced draw of the grid with terrain_heightmap.vert, with a model transform per
+	// instance read from vertex binding 1. Pushes the height map constants after the view projection matrix.
+	void draw(
+		vk::CommandBuffer commandBuffer,
+		vk::PipelineLayout layout,
+		vk::Buffer transforms,
+		vk::DeviceSize transformOffset,
+		uint32_t instanceCount
+	) const;
+
+	// Same with coarse patches for the tessellation stages, which are refined to
+	// TERRAIN_EDGE_PIXELS long edges at the given render size
+	void drawPatches(
+		vk::CommandBuffer commandBuffer,
+		vk::PipelineLayout layout,
+		vk::Buffer transforms,
+		vk::DeviceSize transformOffset,
+		uint32_t instanceCount,
+		vk::Extent2D renderExtent
+	) const;
+
+	// Patches along each side of the height map
+	uint32_t patchesPerSide() const {
+		return (size - 1 + TERRAIN_PATCH_SAMPLES - 1) / TERRAIN_PATCH_SAMPLES;
+	}
+
+	// Cells along each side of a grid patch, and grid patches along each side of the height map
+	uint32_t gridPatchCells() const {
+		return std::min(size - 1, TERRAIN_GRID_PATCH_CELLS);
+	}
+	uint32_t gridPatchesPerSide() const {
+		return (size - 1 + gridPatchCells() - 1) / gridPatchCells();
+	}
+};
+
+
+// Push constants of the height map terrain shaders, following the view projection matrix
+struct HeightmapPushConstants {
+	uint32_t heightmap;
+	uint32_t mapSize;
+	// Only used by the tessellation stages
+	glm::vec2 viewportSize;
+	float edgePixels;
+	uint32_t patchesPerSide;
+};
+
+
+// Colours and band radii of terrain.frag, passed as specialization constants
+// Colours are 0xRRGGBB, radii are distances from the centre in texture coordinates
+struct TerrainPalette {
+	uint32_t ground;
+	uint32_t mountain;
+	uint32_t lava;
+	float lavaRadius;
+	float mountainRadius;
+
+	SpecializationConstants constants() const {
+		return SpecializationConstants{}
+			.set(0, ground)
+			.set(1, mountain)
+			.set(2, lava)
+			.set(3, lavaRadius)
+			.set(4, mountainRadius);
+	}
+};
+
+// Palettes to choose from at runtime, the first matches the shader defaults
+const std::array<TerrainPalette, 3> TERRAIN_PALETTES {{
+	{0x14530a, 0x4a535a, 0xbe2f00, 0.17f, 0.27f},
+	// Snowy peaks around a frozen lake
+	{0xe8eef2, 0x5b6470, 0x3d7fd1, 0.12f, 0.30f},
+	// Desert with an oasis
+	{0xd8b26a, 0x9a6b3c, 0x1f8a5a, 0.08f, 0.22f},
+}};
+
+
+// Rectangle of height map samples, from x0, y0 up to but not including x1, y1
+struct TerrainRegion {
+	size_t x0, y0, x1, y1;
+};
+
+
+class Terrain
+{
+public:
+	// Generate a size x size height map with elevation between 0 and 1
+	// Terrain drawn from a height map image only needs the heights, and keeps no vertices
+	explicit Terrain(size_t size = MAP_SIZE, bool heightsOnly = false);
+
+	size_t size() const {
+		return mapSize;
+	}
+
+	// Full model, for uploading or caching, not available with heights only
+	Model model() const;
+
+	// Set heights in a region, the edit function gets the sample position and current height and
+	// returns the new height. Positions and normals are recomputed for the region plus a one
+	// sample border, since normals depend on neighbouring heights.
+	void edit(TerrainRegion region, const std::function<float(size_t x, size_t y, float height)> &edit);
+
+	// Raise terrain around a point in model space with a smooth falloff, lower it with a negative strength
+	void brush(glm::vec2 center, float radius, float strength);
+
+	// Mark all vertices as changed, for when the uploaded model was replaced
+	void invalidate();
+
+	// Whether there are changes that haven't been uploaded yet
+	bool dirty() const {
+		return dirtyRegion.has_value();
+	}
+
+	// Record copies of the changed vertices from the staging ring into the model's buffers, not
+	// available with heights only
+	// Waits for earlier frames to finish reading the vertices first, so only needs to be recorded
+	// outside a render pass and before the terrain is drawn. Rows that don't fit in the ring
+	// stay dirty for the next frame.
+	void recordUpload(vk::CommandBuffer commandBuffer, MappedRing &staging, const UploadedModel &model);
+
+	// Same for the heights of a height map image of the same size, the texture is ready to draw
+	// once nothing is dirty anymore
+	void recordUpload(vk::CommandBuffer commandBuffer, MappedRing &staging, HeightmapTexture &texture);
+
+private:
+	size_t mapSize;
+	bool heightsOnly;
+	std::vector<float> heights;
+	// Vertices as laid out in the uploaded model, one per height map sample, empty with heights only
+	std::vector<Vertex> vertices;
+	// Changed vertices since the last upload
+	std::optional<TerrainRegion> dirtyRegion{};
+
+	// Make the vertex for a sample with a normal calculated from its neighbours
+	Vertex makeVertex(size_t x, size_t y) const;
 
-// Make terrain model
-Model makeTerrainModel();
\ No newline at end of file
+	// Recompute vertices for a region if there are any, and add it to the dirty region
+	void update(TerrainRegion region);
+};
@@ -0,0 +1,69 @@
+#include "variants.hpp"
+
+
+// Append the bytes of a value to a cache key
+template<typename T>
+static void appendKey(std::string &key, const T &value) {
+	key.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+
+VariantCache::VariantCache(VulkanState &vulkan): vulkan(vulkan) {}
+
+
+// Get the pipeline for the shader stages and their constants, making it if needed
+const Pipeline &VariantCache::get(
+	std::vector<ShaderStage> stages,
+	vk::PipelineVertexInputStateCreateInfo vertexInputInfo,
+	vk::PrimitiveTopology topology,
+	size_t pushConstantSize,
+	DepthMode depthMode,
+	uint32_t patchControlPoints
+) {
+	std::string key{};
+	for (auto &stage: stages) {
+		// Code is stored whole, a hash could collide and hand out the wrong pipeline
+		appendKey(key, stage.stage);
+		appendKey(key, stage.code.size());
+		key.append(reinterpret_cast<const char*>(stage.code.data()), stage.code.size());
+		appendKey(key, stage.constants.entries.size());
+		for (auto &entry: stage.constants.entries) {
+			appendKey(key, entry.constantID);
+			appendKey(key, stage.constants.data.at(entry.offset / sizeof(uint32_t)));
+		}
+	}
+	// Field by field, so padding never ends up in the key
+	appendKey(key, vertexInputInfo.vertexBindingDescriptionCount);
+	for (uint32_t i = 0; i < vertexInputInfo.vertexBindingDescriptionCount; i++) {
+		auto &binding = vertexInputInfo.pVertexBindingDescriptions[i];
+		appendKey(key, binding.binding);
+		appendKey(key, binding.stride);
+		appendKey(key, binding.inputRate);
+	}
+	appendKey(key, vertexInputInfo.vertexAttributeDescriptionCount);
+	for (uint32_t i = 0; i < vertexInputInfo.vertexAttributeDescriptionCount; i++) {
+		auto &attribute = vertexInputInfo.pVertexAttributeDescriptions[i];
+		appendKey(key, attribute.location);
+		appendKey(key, attribute.binding);
+		appendKey(key, attribute.format);
+		appendKey(key, attribute.offset);
+	}
+	appendKey(key, topology);
+	appendKey(key, pushConstantSize);
+	appendKey(key, depthMode);
+	appendKey(key, patchControlPoints);
+
+	auto found = variants.find(key);
+	if (found != variants.end()) {
+		return found->second;
+	}
+	auto pipeline = vulkan.makePipeline(
+		std::move(stages),
+		vertexInputInfo,
+		topology,
+		pushConstantSize,
+		depthMode,
+		patchControlPoints
+	);
+	return variants.emplace(std::move(key), std::move(pipeline)).first->second;
+}
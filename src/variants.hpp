@@ -0,0 +1,45 @@
+#pragma once
+
+// Cache of pipeline variants
+// Shaders take their tunables as specialization constants, so the driver can constant fold them.
+// Each combination of shaders and constant values is made into a pipeline once, on first use,
+// and handed out again for later requests.
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "vulkan.hpp"
+
+
+class VariantCache
+{
+public:
+	explicit VariantCache(VulkanState &vulkan);
+
+	// Get the pipeline for the shader stages and their constants, making it if needed
+	// The key holds the shader code, constant values, vertex bindings and attributes, and the
+	// other parameters, so pipelines are only shared by identical requests
+	const Pipeline &get(
+		std::vector<ShaderStage> stages,
+		vk::PipelineVertexInputStateCreateInfo vertexInputInfo,
+		vk::PrimitiveTopology topology,
+		size_t pushConstantSize,
+		DepthMode depthMode = DepthMode::ReadWrite,
+		uint32_t patchControlPoints = 0
+	);
+
+	// Number of pipelines made so far
+	size_t size() const {
+		return variants.size();
+	}
+
+	// Free all pipelines, none may be in use
+	void reset() {
+		variants.clear();
+	}
+
+private:
+	VulkanState &vulkan;
+	std::map<std::string, Pipeline> variants{};
+};
@@ -1,6 +1,9 @@
 // Helper code and boilerplate for Vulkan setup
 
 #include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <tuple>
 
 #define GLFW_INCLUDE_VULKAN
 #include <GLFW/glfw3.h>
@@ -10,17 +13,6 @@
 #include "util.h"
 
 
-// Pick a queue family to use
-static std::optional<uint32_t> pickQueueFamily(std::vector<vk::QueueFamilyProperties> &queueFamilies) {
-	// Pick any queue family that supports graphics
-	for (size_t i = 0; i < queueFamilies.size(); i++) {
-		if (queueFamilies.at(i).queueFlags & vk::QueueFlagBits::eGraphics)
-			return i;
-	}
-	return {};
-}
-
-
 // Pick surface format with preference for a given format
 static vk::SurfaceFormatKHR pickFormat(std::vector<vk::SurfaceFormatKHR> &formats, vk::SurfaceFormatKHR preferredFormat) {
 	for (auto &format: formats) {
@@ -34,72 +26,234 @@ static vk::SurfaceFormatKHR pickFormat(std::vector<vk::SurfaceFormatKHR> &format
 
 
 // Initial setup, create device
-void VulkanState::init() {
+void VulkanState::init(const char *deviceOverride, bool allowDynamicRendering) {
+	// Use up to Vulkan 1.2, older loaders only know 1.0
+	apiVersion = std::min(vk::enumerateInstanceVersion(), (uint32_t) VK_API_VERSION_1_2);
+	vk::ApplicationInfo applicationInfo{};
+	applicationInfo.pApplicationName = "vulkan-demo";
+	applicationInfo.apiVersion = apiVersion;
+
 	// Create instance, with extensions needed by GLFW
 	uint32_t extension_count;
 	const char **extensions = glfwGetRequiredInstanceExtensions(&extension_count);
 	vk::InstanceCreateInfo instanceInfo{};
+	instanceInfo.pApplicationInfo = &applicationInfo;
 	instanceInfo.enabledExtensionCount = extension_count;
 	instanceInfo.ppEnabledExtensionNames = extensions;
 	instance = vk::createInstanceUnique(instanceInfo);
 
-	auto physicalDevices = instance->enumeratePhysicalDevices();
-	// todo: Just picking the first device for now...
-	physicalDevice = physicalDevices.at(0);
-
-	auto queueFamilies = physicalDevice.getQueueFamilyProperties();
+	// Profile all devices and pick the fastest one that has everything we need
+	std::vector<DeviceProfile> profiles{};
+	for (auto candidate: instance->enumeratePhysicalDevices()) {
+		profiles.push_back(profileDevice(*instance, candidate, apiVersion));
+	}
+	auto picked = pickDevice(profiles, deviceOverride);
+	if (picked == nullptr) {
+		for (auto &profile: profiles) {
+			if (!profile.suitable())
+				fprintf(stderr, "%s: %s\n", &profile.properties.deviceName[0], profile.unsuitableReason.c_str());
+		}
+	}
+	assertThat(picked, "No usable Vulkan device\n");
+	deviceProfile = *picked;
+	printDeviceProfile(deviceProfile);
+	physicalDevice = deviceProfile.physicalDevice;
+	// Device level features are limited by both instance and device version
+	apiVersion = deviceProfile.apiVersion;
+
+	auto &queueFamilies = deviceProfile.queueFamilies;
 	queueFamily = pickQueueFamily(queueFamilies).value();
-
+	// Dedicated families let compute and transfer work run alongside rendering,
+	// without them everything goes to the graphics family
+	computeQueueFamily = pickDedicatedQueueFamily(
+		queueFamilies,
+		vk::QueueFlagBits::eCompute,
+		vk::QueueFlagBits::eGraphics
+	).value_or(queueFamily);
+	transferQueueFamily = pickDedicatedQueueFamily(
+		queueFamilies,
+		vk::QueueFlagBits::eTransfer,
+		vk::QueueFlagBits::eGraphics | vk::QueueFlagBits::eCompute
+	).value_or(queueFamily);
+
+	// One queue from each distinct family
 	float queuePriority = 0.5;
-	vk::DeviceQueueCreateInfo queueInfo{};
-	queueInfo.queueFamilyIndex = queueFamily;
-	queueInfo.queueCount = 1;
-	queueInfo.pQueuePriorities = &queuePriority;
+	std::vector<vk::DeviceQueueCreateInfo> queueInfos{};
+	for (uint32_t family: {queueFamily, computeQueueFamily, transferQueueFamily}) {
+		bool added = std::any_of(queueInfos.begin(), queueInfos.end(), [&](auto &info) {
+			return info.queueFamilyIndex == family;
+		});
+		if (!added) {
+			vk::DeviceQueueCreateInfo queueInfo{};
+			queueInfo.queueFamilyIndex = family;
+			queueInfo.queueCount = 1;
+			queueInfo.pQueuePriorities = &queuePriority;
+			queueInfos.push_back(queueInfo);
+		}
+	}
 
 	vk::PhysicalDeviceFeatures enabledFeatures{};
 	// Need large points for our particles
 	enabledFeatures.largePoints = true;
+	// Tessellated terrain is optional
+	enabledFeatures.tessellationShader = deviceProfile.tessellation;
+
+	// Availability was checked when profiling the device
+	std::vector<const char*> requiredExtensions(REQUIRED_DEVICE_EXTENSIONS.begin(), REQUIRED_DEVICE_EXTENSIONS.end());
+
+	// Bindless descriptors are optional, pipelines just don't get the global set without them
+	bool bindlessSupported = deviceProfile.bindless;
+	vk::PhysicalDeviceDescriptorIndexingFeatures indexingFeatures{};
+	if (bindlessSupported) {
+		enabledFeatures.shaderSampledImageArrayDynamicIndexing = true;
+		enabledFeatures.shaderStorageBufferArrayDynamicIndexing = true;
+		indexingFeatures.runtimeDescriptorArray = true;
+		indexingFeatures.descriptorBindingPartiallyBound = true;
+		indexingFeatures.descriptorBindingSampledImageUpdateAfterBind = true;
+		indexingFeatures.descriptorBindingStorageBufferUpdateAfterBind = true;
+		if (apiVersion < VK_API_VERSION_1_2) {
+			requiredExtensions.push_back("VK_EXT_descriptor_indexing");
+		}
+	}
 
-	// todo: should verify extension support with physical device
-	std::vector<const char*> requiredExtensions {
-		"VK_KHR_swapchain",
-	};
+	// Budgets of other processes' usage are optional, we fall back to counting our own allocations
+	if (deviceProfile.memoryBudget) {
+		requiredExtensions.push_back("VK_EXT_memory_budget");
+	}
+
+	// Multiview is optional too, only used when rendering several views
+	vk::PhysicalDeviceMultiviewFeatures multiviewFeatures{};
+	multiviewFeatures.multiview = deviceProfile.multiview;
+	multiviewFeatures.pNext = bindlessSupported ? &indexingFeatures : nullptr;
+
+	// Render passes and frame buffers are the fallback without dynamic rendering
+	dynamicRendering = allowDynamicRendering && deviceProfile.dynamicRendering;
+	vk::PhysicalDeviceDynamicRenderingFeaturesKHR dynamicRenderingFeatures{};
+	if (dynamicRendering) {
+		requiredExtensions.push_back("VK_KHR_dynamic_rendering");
+		dynamicRenderingFeatures.dynamicRendering = true;
+		dynamicRenderingFeatures.pNext = multiviewFeatures.pNext;
+		multiviewFeatures.pNext = &dynamicRenderingFeatures;
+	}
 
 	vk::DeviceCreateInfo deviceInfo{};
-	deviceInfo.queueCreateInfoCount = 1;
-	deviceInfo.pQueueCreateInfos = &queueInfo;
+	// Feature structs can only be chained from Vulkan 1.1, which bindless needs too
+	deviceInfo.pNext = apiVersion >= VK_API_VERSION_1_1 ? &multiviewFeatures : nullptr;
+	deviceInfo.queueCreateInfoCount = queueInfos.size();
+	deviceInfo.pQueueCreateInfos = queueInfos.data();
 	deviceInfo.pEnabledFeatures = &enabledFeatures;
 	deviceInfo.enabledExtensionCount = requiredExtensions.size();
 	deviceInfo.ppEnabledExtensionNames = requiredExtensions.data();
 	device = physicalDevice.createDeviceUnique(deviceInfo);
+	dispatch.init(*instance, vkGetInstanceProcAddr, *device);
 	queue = device->getQueue(queueFamily, 0);
+	// Same queue as the graphics one when sharing a family
+	computeQueue = device->getQueue(computeQueueFamily, 0);
+	transferQueue = device->getQueue(transferQueueFamily, 0);
+
+	memoryBudget.init(physicalDevice, deviceProfile.memoryBudget, heapCounters);
+
+	if (bindlessSupported) {
+		auto properties = physicalDevice.getProperties2<vk::PhysicalDeviceProperties2, vk::PhysicalDeviceDescriptorIndexingProperties>();
+		auto &indexingProperties = properties.get<vk::PhysicalDeviceDescriptorIndexingProperties>();
+		uint32_t maxImages = std::min({
+			BINDLESS_MAX_DESCRIPTORS,
+			indexingProperties.maxDescriptorSetUpdateAfterBindSampledImages,
+			indexingProperties.maxDescriptorSetUpdateAfterBindSamplers,
+			indexingProperties.maxPerStageDescriptorUpdateAfterBindSampledImages,
+			indexingProperties.maxPerStageDescriptorUpdateAfterBindSamplers,
+		});
+		uint32_t maxBuffers = std::min({
+			BINDLESS_MAX_DESCRIPTORS,
+			indexingProperties.maxDescriptorSetUpdateAfterBindStorageBuffers,
+			indexingProperties.maxPerStageDescriptorUpdateAfterBindStorageBuffers,
+		});
+		bindless.emplace(*device, maxImages, maxBuffers);
+	}
 
 	// We will just keep a command buffer for each frame and reset them at the start of the fram
 	vk::CommandPoolCreateInfo poolInfo{};
 	poolInfo.flags = vk::CommandPoolCreateFlagBits::eResetCommandBuffer | vk::CommandPoolCreateFlagBits::eTransient;
 	poolInfo.queueFamilyIndex = queueFamily;
 	commandPool = device->createCommandPoolUnique(poolInfo);
+	poolInfo.queueFamilyIndex = computeQueueFamily;
+	computeCommandPool = device->createCommandPoolUnique(poolInfo);
+
+	// Query pool for measuring GPU frame time, if the queue can write timestamps
+	if (queueFamilies.at(queueFamily).timestampValidBits > 0) {
+		vk::QueryPoolCreateInfo queryPoolInfo{};
+		queryPoolInfo.queryType = vk::QueryType::eTimestamp;
+		queryPoolInfo.queryCount = 2 * MAX_FRAMES_IN_FLIGHT;
+		timestampPool = device->createQueryPoolUnique(queryPoolInfo);
+		timestampPeriod = deviceProfile.properties.limits.timestampPeriod;
+	}
 
 	// Initialize per-frame state
 	vk::CommandBufferAllocateInfo perFrameCommandBufferInfo{};
 	perFrameCommandBufferInfo.commandPool = *commandPool;
 	perFrameCommandBufferInfo.commandBufferCount = 1;
+	vk::CommandBufferAllocateInfo computeCommandBufferInfo{};
+	computeCommandBufferInfo.commandPool = *computeCommandPool;
+	computeCommandBufferInfo.commandBufferCount = 1;
 	for (PerFrame &pf: perFrame) {
 		// Start signalled to indicate the frame is ready to be rendered
 		pf.frameFence = device->createFenceUnique({vk::FenceCreateFlagBits::eSignaled});
 		pf.acquireImageSemaphore = device->createSemaphoreUnique({});
 		pf.submitSemaphore = device->createSemaphoreUnique({});
 		pf.commandBuffer = device->allocateCommandBuffers(perFrameCommandBufferInfo).at(0);
+		pf.computeSemaphore = device->createSemaphoreUnique({});
+		pf.computeCommandBuffer = device->allocateCommandBuffers(computeCommandBufferInfo).at(0);
+	}
+
+	// A single view until told otherwise
+	setViews(1, false);
+}
+
+
+// Set the number of views and whether to render them with multiview
+void VulkanState::setViews(uint32_t count, bool useMultiview) {
+	assertThat((!surface), "Views must be set before the surface\n");
+	assertThat((count > 0), "Need at least one view\n");
+	if (useMultiview) {
+		assertThat(deviceProfile.multiview, "Multiview not supported by selected device\n");
+		assertThat((count <= deviceProfile.maxViews), "More views than the device supports with multiview\n");
+	}
+	viewCount = count;
+	multiview = useMultiview && count > 1;
+
+	// The render pass depends on the views but not on the surface
+	if (!dynamicRendering) {
+		createRenderpass();
 	}
 }
 
 
+// Set the samples per pixel
+uint32_t VulkanState::setSamples(uint32_t count) {
+	assertThat((!surface), "Samples must be set before the surface\n");
+	auto &limits = deviceProfile.properties.limits;
+	vk::SampleCountFlags supported = limits.framebufferColorSampleCounts & limits.framebufferDepthSampleCounts;
+	// Highest power of two the device supports, up to the requested count
+	uint32_t used = 1;
+	for (uint32_t candidate = 2; candidate <= std::min(count, (uint32_t) 64); candidate *= 2) {
+		if (supported & static_cast<vk::SampleCountFlagBits>(candidate)) {
+			used = candidate;
+		}
+	}
+	samples = static_cast<vk::SampleCountFlagBits>(used);
+
+	if (!dynamicRendering) {
+		createRenderpass();
+	}
+	return used;
+}
+
+
 // Set surface and create swap chain
 void VulkanState::setSurface(VkSurfaceKHR surface) {
 	assertThat(physicalDevice.getSurfaceSupportKHR(queueFamily, surface), "Surface not supported by selected device\n");
 	this->surface = surface;
 	createSwapchain();
-	createRenderpass();
 	setupFramebuffers();
 }
 
@@ -108,7 +262,6 @@ void VulkanState::setSurface(VkSurfaceKHR surface) {
 // Should do this before we free the surface, so can't just rely on the destructor
 void VulkanState::unsetSurface() {
 	unsetFramebuffers();
-	unsetRenderpass();
 	unsetSwapchain();
 	surface = nullptr;
 }
@@ -116,29 +269,44 @@ void VulkanState::unsetSurface() {
 
 // Make a render pipeline
 Pipeline VulkanState::makePipeline(
-	std::vector<uint8_t> vertexShaderCode,
-	std::vector<uint8_t> fragmentShaderCode,
+	std::vector<ShaderStage> stages,
 	vk::PipelineVertexInputStateCreateInfo vertexInputInfo,
 	vk::PrimitiveTopology topology,
-	size_t pushConstantSize
+	size_t pushConstantSize,
+	DepthMode depthMode,
+	uint32_t patchControlPoints
 ) {
-	assertThat(renderpass, "Surface must be set before making pipeline\n");
-	auto vertexModule = makeShaderModule(vertexShaderCode);
-	auto fragmentModule = makeShaderModule(fragmentShaderCode);
-
-	vk::PipelineShaderStageCreateInfo vertexStage{};
-	vertexStage.stage = vk::ShaderStageFlagBits::eVertex;
-	vertexStage.module = *vertexModule;
-	vertexStage.pName = "main";
-	vk::PipelineShaderStageCreateInfo fragmentStage{};
-	fragmentStage.stage = vk::ShaderStageFlagBits::eFragment;
-	fragmentStage.module = *fragmentModule;
-	fragmentStage.pName = "main";
-	std::array<vk::PipelineShaderStageCreateInfo, 2> shaderStages { vertexStage, fragmentStage };
+	assertThat((dynamicRendering || renderpass), "Views must be set before making pipeline\n");
+	bool depthOnly = std::none_of(stages.begin(), stages.end(), [](auto &stage) {
+		return stage.stage == vk::ShaderStageFlagBits::eFragment;
+	});
+
+	// Modules only need to live until the pipeline is created
+	std::vector<vk::UniqueShaderModule> modules{};
+	// Reserved, so stages can point into it
+	std::vector<vk::SpecializationInfo> specializationInfos{};
+	specializationInfos.reserve(stages.size());
+	std::vector<vk::PipelineShaderStageCreateInfo> shaderStages{};
+	for (auto &stage: stages) {
+		modules.push_back(makeShaderModule(stage.code));
+		specializationInfos.push_back(stage.constants.info());
+		vk::PipelineShaderStageCreateInfo stageInfo{};
+		stageInfo.stage = stage.stage;
+		stageInfo.module = *modules.back();
+		stageInfo.pName = "main";
+		stageInfo.pSpecializationInfo = &specializationInfos.back();
+		shaderStages.push_back(stageInfo);
+	}
 
 	vk::PipelineInputAssemblyStateCreateInfo inputInfo{};
 	inputInfo.topology = topology;
 
+	// Patches are only drawn with tessellation stages
+	bool tessellated = topology == vk::PrimitiveTopology::ePatchList;
+	assertThat((!tessellated || patchControlPoints > 0), "Patch list pipeline needs the number of control points\n");
+	vk::PipelineTessellationStateCreateInfo tessellationInfo{};
+	tessellationInfo.patchControlPoints = patchControlPoints;
+
 	vk::PipelineViewportStateCreateInfo viewportInfo{{}, 1, &viewport, 1, &scissor};
 
 	vk::PipelineRasterizationStateCreateInfo rasterizationInfo{};
@@ -146,19 +314,24 @@ Pipeline VulkanState::makePipeline(
 	rasterizationInfo.lineWidth = 1.0;
 
 	vk::PipelineMultisampleStateCreateInfo multisampleInfo{};
+	multisampleInfo.rasterizationSamples = samples;
 
 	vk::PipelineDepthStencilStateCreateInfo depthStencilInfo{};
-	depthStencilInfo.depthTestEnable = true;
-	depthStencilInfo.depthWriteEnable = true;
-	depthStencilInfo.depthCompareOp = vk::CompareOp::eLess;
+	depthStencilInfo.depthTestEnable = depthMode != DepthMode::Disabled;
+	// Depth is only written by pipelines that lay it down, so the equal test of
+	// a pre-pass pipeline and the early test of discarding shaders stay cheap
+	depthStencilInfo.depthWriteEnable = depthMode == DepthMode::ReadWrite;
+	depthStencilInfo.depthCompareOp = depthMode == DepthMode::Equal ? vk::CompareOp::eEqual : vk::CompareOp::eLess;
 
 	vk::PipelineColorBlendAttachmentState blendAttachment{};
-	blendAttachment.colorWriteMask = (
-		vk::ColorComponentFlagBits::eR |
-		vk::ColorComponentFlagBits::eG |
-		vk::ColorComponentFlagBits::eB |
-		vk::ColorComponentFlagBits::eA
-	);
+	if (!depthOnly) {
+		blendAttachment.colorWriteMask = (
+			vk::ColorComponentFlagBits::eR |
+			vk::ColorComponentFlagBits::eG |
+			vk::ColorComponentFlagBits::eB |
+			vk::ColorComponentFlagBits::eA
+		);
+	}
 
 	vk::PipelineColorBlendStateCreateInfo colorBlendInfo{};
 	colorBlendInfo.attachmentCount = 1;
@@ -173,20 +346,37 @@ Pipeline VulkanState::makePipeline(
 	dynamicStateInfo.pDynamicStates = dynamicStates.data();
 
 	vk::PushConstantRange pushConstantRange{};
-	pushConstantRange.stageFlags = vk::ShaderStageFlagBits::eVertex;
+	pushConstantRange.stageFlags = PUSH_CONSTANT_STAGES;
 	pushConstantRange.offset = 0;
 	pushConstantRange.size = pushConstantSize;
 	vk::PipelineLayoutCreateInfo layoutInfo{};
 	layoutInfo.pushConstantRangeCount = 1;
 	layoutInfo.pPushConstantRanges = &pushConstantRange;
+	if (bindless) {
+		// Layouts are only compatible for the global set if the push constant ranges match too,
+		// so every pipeline gets the same range and the set stays bound across pipeline changes
+		assertThat((pushConstantSize <= BINDLESS_PUSH_CONSTANT_SIZE), "Push constants too large for bindless layout\n");
+		pushConstantRange.size = BINDLESS_PUSH_CONSTANT_SIZE;
+		layoutInfo.setLayoutCount = 1;
+		layoutInfo.pSetLayouts = &*bindless->layout;
+	}
 
 	vk::UniquePipelineLayout pipelineLayout = device->createPipelineLayoutUnique(layoutInfo);
 
+	// Without a render pass the pipeline is made for the render target formats and views
+	vk::PipelineRenderingCreateInfoKHR renderingInfo{};
+	renderingInfo.viewMask = multiview ? viewMask() : 0;
+	renderingInfo.colorAttachmentCount = 1;
+	renderingInfo.pColorAttachmentFormats = &colorFormat;
+	renderingInfo.depthAttachmentFormat = depthFormat;
+
 	vk::GraphicsPipelineCreateInfo pipelineInfo{};
+	pipelineInfo.pNext = dynamicRendering ? &renderingInfo : nullptr;
 	pipelineInfo.stageCount = shaderStages.size();
 	pipelineInfo.pStages = shaderStages.data();
 	pipelineInfo.pVertexInputState = &vertexInputInfo;
 	pipelineInfo.pInputAssemblyState = &inputInfo;
+	pipelineInfo.pTessellationState = tessellated ? &tessellationInfo : nullptr;
 	pipelineInfo.pViewportState = &viewportInfo;
 	pipelineInfo.pRasterizationState = &rasterizationInfo;
 	pipelineInfo.pMultisampleState = &multisampleInfo;
@@ -194,7 +384,7 @@ Pipeline VulkanState::makePipeline(
 	pipelineInfo.pColorBlendState = &colorBlendInfo;
 	pipelineInfo.pDynamicState = &dynamicStateInfo;
 	pipelineInfo.layout = *pipelineLayout;
-	pipelineInfo.renderPass = *renderpass;
+	pipelineInfo.renderPass = dynamicRendering ? nullptr : *renderpass;
 	pipelineInfo.basePipelineIndex = -1;
 
 	vk::UniquePipeline pipeline = device->createGraphicsPipelineUnique(nullptr, pipelineInfo);
@@ -205,15 +395,159 @@ Pipeline VulkanState::makePipeline(
 }
 
 
+// Make a compute pipeline with the given descriptor set layouts
+Pipeline VulkanState::makeComputePipeline(
+	std::vector<uint8_t> shaderCode,
+	std::vector<vk::DescriptorSetLayout> setLayouts,
+	size_t pushConstantSize,
+	const SpecializationConstants &constants
+) {
+	auto module = makeShaderModule(shaderCode);
+
+	auto specializationInfo = constants.info();
+	vk::PipelineShaderStageCreateInfo stage{};
+	stage.stage = vk::ShaderStageFlagBits::eCompute;
+	stage.module = *module;
+	stage.pName = "main";
+	stage.pSpecializationInfo = &specializationInfo;
+
+	vk::PushConstantRange pushConstantRange{};
+	pushConstantRange.stageFlags = vk::ShaderStageFlagBits::eCompute;
+	pushConstantRange.offset = 0;
+	pushConstantRange.size = pushConstantSize;
+	vk::PipelineLayoutCreateInfo layoutInfo{};
+	layoutInfo.setLayoutCount = setLayouts.size();
+	layoutInfo.pSetLayouts = setLayouts.data();
+	layoutInfo.pushConstantRangeCount = 1;
+	layoutInfo.pPushConstantRanges = &pushConstantRange;
+
+	vk::UniquePipelineLayout pipelineLayout = device->createPipelineLayoutUnique(layoutInfo);
+
+	vk::ComputePipelineCreateInfo pipelineInfo{};
+	pipelineInfo.stage = stage;
+	pipelineInfo.layout = *pipelineLayout;
+	pipelineInfo.basePipelineIndex = -1;
+
+	vk::UniquePipeline pipeline = device->createComputePipelineUnique(nullptr, pipelineInfo);
+	return {
+		std::move(pipelineLayout),
+		std::move(pipeline)
+	};
+}
+
+
+// Bind the global bindless set, if supported, for all pipelines used in the command buffer
+void VulkanState::bindGlobalDescriptors(vk::CommandBuffer commandBuffer, vk::PipelineBindPoint bindPoint, vk::PipelineLayout layout) {
+	if (bindless) {
+		bindless->bind(commandBuffer, bindPoint, layout);
+	}
+}
+
+
+// Begin one of the passes of a frame
+void VulkanState::beginPass(
+	vk::CommandBuffer commandBuffer,
+	uint32_t pass,
+	vk::ImageView multisampledView,
+	vk::ImageView depthView,
+	const std::array<vk::ClearValue, 2> &clearValues
+) {
+	// Separate passes render into a single layer, a multiview pass into all of them
+	vk::ImageView colorView = passCount() == 1 ? *colorTarget.view : *colorLayerViews.at(pass);
+	bool resolve = samples != vk::SampleCountFlagBits::e1;
+	assertThat((!resolve || multisampledView), "Multisampled pass needs a multisampled color image\n");
+
+	if (!dynamicRendering) {
+		vk::RenderPassBeginInfo renderPassInfo{};
+		renderPassInfo.renderPass = *renderpass;
+		renderPassInfo.framebuffer = framebuffer(colorView, depthView, multisampledView);
+		renderPassInfo.renderArea.offset = vk::Offset2D(0, 0);
+		renderPassInfo.renderArea.extent = renderExtent;
+		// The resolve attachment comes last and isn't cleared, so it needs no clear value
+		renderPassInfo.clearValueCount = clearValues.size();
+		renderPassInfo.pClearValues = clearValues.data();
+		commandBuffer.beginRenderPass(renderPassInfo, vk::SubpassContents::eInline);
+		return;
+	}
+
+	vk::RenderingAttachmentInfoKHR colorAttachment{};
+	colorAttachment.imageView = colorView;
+	colorAttachment.imageLayout = vk::ImageLayout::eColorAttachmentOptimal;
+	colorAttachment.loadOp = vk::AttachmentLoadOp::eClear;
+	colorAttachment.storeOp = vk::AttachmentStoreOp::eStore;
+	colorAttachment.clearValue = clearValues[0];
+	if (resolve) {
+		// Samples are averaged into the color target as the pass ends, and never written out themselves
+		colorAttachment.imageView = multisampledView;
+		colorAttachment.storeOp = vk::AttachmentStoreOp::eDontCare;
+		colorAttachment.resolveMode = vk::ResolveModeFlagBits::eAverage;
+		colorAttachment.resolveImageView = colorView;
+		colorAttachment.resolveImageLayout = vk::ImageLayout::eColorAttachmentOptimal;
+	}
+	vk::RenderingAttachmentInfoKHR depthAttachment{};
+	depthAttachment.imageView = depthView;
+	depthAttachment.imageLayout = vk::ImageLayout::eDepthStencilAttachmentOptimal;
+	depthAttachment.loadOp = vk::AttachmentLoadOp::eClear;
+	depthAttachment.storeOp = vk::AttachmentStoreOp::eDontCare;
+	depthAttachment.clearValue = clearValues[1];
+
+	vk::RenderingInfoKHR renderingInfo{};
+	renderingInfo.renderArea.offset = vk::Offset2D(0, 0);
+	renderingInfo.renderArea.extent = renderExtent;
+	renderingInfo.layerCount = 1;
+	renderingInfo.viewMask = multiview ? viewMask() : 0;
+	renderingInfo.colorAttachmentCount = 1;
+	renderingInfo.pColorAttachments = &colorAttachment;
+	renderingInfo.pDepthAttachment = &depthAttachment;
+	commandBuffer.beginRenderingKHR(renderingInfo, dispatch);
+}
+
+
+// End a pass started with beginPass
+void VulkanState::endPass(vk::CommandBuffer commandBuffer) {
+	if (dynamicRendering) {
+		commandBuffer.endRenderingKHR(dispatch);
+	} else {
+		commandBuffer.endRenderPass();
+	}
+}
+
+
+// Destroy the frame buffers once frames in flight are done with them
+void VulkanState::releaseFramebuffers() {
+	for (auto &entry: framebuffers) {
+		destroyLater(std::move(entry.second));
+	}
+	framebuffers.clear();
+}
+
+
 // Get next image from the swap chain
 // Pretty leaky abstraction, caller must set e.g. set fence
 std::optional<std::pair<uint32_t, PerFrame&>> VulkanState::acquireImage() {
 	if (shouldRecreateSwapchain) {
 		recreateSwapchain();
 	}
-	PerFrame &frame = perFrame[nextFrame()];
+	size_t frameIndex = nextFrame();
+	PerFrame &frame = perFrame[frameIndex];
+
+	// Everything recorded since the last acquire belongs to the previous frame
+	auto acquireTime = std::chrono::steady_clock::now();
+	if (stats.frames > 0) {
+		stats.cpuFrameTime.add(std::chrono::duration<float, std::milli>(acquireTime - lastAcquireTime).count());
+	}
+	lastAcquireTime = acquireTime;
+	stats.last = stats.current;
+	stats.current = {};
+	stats.frames++;
+
 	// Wait if we already have maximum amount of frames in flight
 	device->waitForFences(*frame.frameFence, true, UINT64_MAX);
+	stats.fenceWaitTime.add(std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - acquireTime).count());
+	readFrameTimer(frameIndex);
+	// Everything released the last time this frame index was current is unused now
+	deletionQueue.collect(frameIndex);
+	memoryBudget.update(stats.frames);
 	try {
 		uint32_t imageIndex = device->acquireNextImageKHR(*swapchain, UINT64_MAX, *frame.acquireImageSemaphore, nullptr);
 		// Could get images out of order, so wait if image is already in use by another frame
@@ -235,8 +569,68 @@ void VulkanState::requestRecreateSwapchain() {
 }
 
 
-// Create a buffer with inital data
-BufferAndMemory VulkanState::createBufferWithData(vk::BufferUsageFlags usage, size_t size, uint8_t *data) {
+// Set fraction of the swap chain extent to render at
+void VulkanState::setRenderScale(float scale) {
+	renderScale = std::clamp(scale, 0.0f, 1.0f);
+	renderExtent.width = std::max((uint32_t) 1, (uint32_t) (viewExtent.width * renderScale));
+	renderExtent.height = std::max((uint32_t) 1, (uint32_t) (viewExtent.height * renderScale));
+
+	viewport = vk::Viewport(
+		0, 0,
+		renderExtent.width, renderExtent.height,
+		0.0, 1.0
+	);
+	scissor.offset = vk::Offset2D(0, 0);
+	scissor.extent = renderExtent;
+}
+
+
+// Record timestamp at the start of the frame's command buffer
+void VulkanState::beginFrameTimer(vk::CommandBuffer commandBuffer) {
+	if (!timestampPool) {
+		return;
+	}
+	uint32_t firstQuery = currentFrame * 2;
+	commandBuffer.resetQueryPool(*timestampPool, firstQuery, 2);
+	commandBuffer.writeTimestamp(vk::PipelineStageFlagBits::eTopOfPipe, *timestampPool, firstQuery);
+}
+
+
+// Record timestamp at the end of the frame's command buffer
+void VulkanState::endFrameTimer(vk::CommandBuffer commandBuffer) {
+	if (!timestampPool) {
+		return;
+	}
+	commandBuffer.writeTimestamp(vk::PipelineStageFlagBits::eBottomOfPipe, *timestampPool, currentFrame * 2 + 1);
+	perFrame[currentFrame].timestampsWritten = true;
+}
+
+
+// Scale the rendered color target up to the swap chain image
+void VulkanState::recordPresentBlit(vk::CommandBuffer commandBuffer, uint32_t imageIndex) {
+	vk::Image image = swapchainImages.at(imageIndex);
+
+	// Each view layer goes to its own column of the swap chain image
+	std::vector<vk::ImageBlit> blits(viewCount);
+	for (uint32_t view = 0; view < viewCount; view++) {
+		vk::ImageBlit &blit = blits[view];
+		blit.srcSubresource = vk::ImageSubresourceLayers{vk::ImageAspectFlagBits::eColor, 0, view, 1};
+		blit.srcOffsets[1] = vk::Offset3D(renderExtent.width, renderExtent.height, 1);
+		blit.dstSubresource = vk::ImageSubresourceLayers{vk::ImageAspectFlagBits::eColor, 0, 0, 1};
+		blit.dstOffsets[0] = vk::Offset3D(currentExtent.width * view / viewCount, 0, 0);
+		blit.dstOffsets[1] = vk::Offset3D(currentExtent.width * (view + 1) / viewCount, currentExtent.height, 1);
+	}
+	commandBuffer.blitImage(
+		*colorTarget.image, vk::ImageLayout::eTransferSrcOptimal,
+		image, vk::ImageLayout::eTransferDstOptimal,
+		blits,
+		vk::Filter::eLinear
+	);
+}
+
+
+// Create a buffer backed by memory with the given properties
+BufferAndMemory VulkanState::createBuffer(vk::BufferUsageFlags usage, size_t size, vk::MemoryPropertyFlags memoryProperties) {
 	BufferAndMemory buffer{};
 
 	vk::BufferCreateInfo bufferInfo{};
@@ -245,17 +639,22 @@ BufferAndMemory VulkanState::createBufferWithData(vk::BufferUsageFlags usage, si
 	buffer.buffer = device->createBufferUnique(bufferInfo);
 
 	auto requirements = device->getBufferMemoryRequirements(*buffer.buffer);
-	vk::MemoryAllocateInfo allocateInfo{
-		requirements.size,
-		findMemoryType(
-			requirements.memoryTypeBits,
-			vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent
-		)
-	};
-	buffer.memory = device->allocateMemoryUnique(allocateInfo);
+	std::tie(buffer.memory, buffer.allocation) = allocateMemory(requirements, memoryProperties);
 
 	device->bindBufferMemory(*buffer.buffer, *buffer.memory, 0);
 
+	return buffer;
+}
+
+
+// Create a buffer with inital data
+BufferAndMemory VulkanState::createBufferWithData(vk::BufferUsageFlags usage, size_t size, const uint8_t *data) {
+	BufferAndMemory buffer = createBuffer(
+		usage,
+		size,
+		vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent
+	);
+
 	// Write inital data to buffer
 	void *mapped = device->mapMemory(*buffer.memory, 0, size, {});
 	memcpy(mapped, data, size);
@@ -269,15 +668,14 @@ BufferAndMemory VulkanState::createBufferWithData(vk::BufferUsageFlags usage, si
 void VulkanState::recreateSwapchain() {
 	device->waitIdle();
 
-	// Should techhnically recreate render pass and pipelines here too,
-	// but is a bit inconvenient with current structure.
-	// Should be OK as long as the surface format doesn't change
+	// Render pass and pipelines only depend on the render target formats, not the surface
 	unsetFramebuffers();
 	unsetSwapchain();
 	createSwapchain();
 	setupFramebuffers();
 
 	shouldRecreateSwapchain = false;
+	stats.swapchainRecreations++;
 }
 
 
@@ -289,6 +687,7 @@ void VulkanState::createSwapchain() {
 		currentExtent.width = std::min(std::max((uint32_t) 800, capabilities.minImageExtent.width), capabilities.maxImageExtent.width);
 		currentExtent.height = std::min(std::max((uint32_t) 600, capabilities.minImageExtent.height), capabilities.maxImageExtent.height);
 	}
+	viewExtent = vk::Extent2D(std::max((uint32_t) 1, currentExtent.width / viewCount), currentExtent.height);
 
 	currentSurfaceFormat = pickFormat(
 		formats,
@@ -305,160 +704,301 @@ void VulkanState::createSwapchain() {
 	swapchainInfo.compositeAlpha = vk::CompositeAlphaFlagBitsKHR::eOpaque;
 	swapchainInfo.presentMode = vk::PresentModeKHR::eFifo;
 	swapchainInfo.clipped = true;
-	swapchainInfo.imageUsage = vk::ImageUsageFlagBits::eColorAttachment;
+	// Rendering happens in a separate color target that is blitted to the swap chain
+	assertThat((capabilities.supportedUsageFlags & vk::ImageUsageFlagBits::eTransferDst), "Surface does not support transfer to swap chain images\n");
+	swapchainInfo.imageUsage = vk::ImageUsageFlagBits::eTransferDst;
 	swapchainInfo.queueFamilyIndexCount = 0;
 	swapchainInfo.pQueueFamilyIndices = nullptr;
 	swapchain = device->createSwapchainKHRUnique(swapchainInfo);
 	swapchainImages = device->getSwapchainImagesKHR(*swapchain);
 
-	for (auto &image: swapchainImages) {
-		swapchainImageViews.emplace_back(
-			createImageView(image, currentSurfaceFormat.format, vk::ImageAspectFlagBits::eColor)
-		);
-		swapchainFences.push_back(nullptr);
-	}
+	// Images are only blitted to, so they need no views
+	swapchainFences.assign(swapchainImages.size(), nullptr);
 
-	viewport = vk::Viewport(
-		0, 0,
-		currentExtent.width, currentExtent.height,
-		0.0, 1.0
-	);
-	scissor.offset = vk::Offset2D(0, 0);
-	scissor.extent = currentExtent;
+	// Keep the current render scale for the new extent
+	setRenderScale(renderScale);
 }
 
 
 // Free resources for swap chain
 void VulkanState::unsetSwapchain() {
 	swapchainFences.clear();
-	swapchainImageViews.clear();
 	swapchainImages.clear();
 	swapchain.reset();
 }
 
 
 void VulkanState::createRenderpass() {
+	// Layouts and dependencies before and after the pass come from the render graph's barriers,
+	// so the attachments stay in their attachment layouts
+	// With several samples, color is drawn to a multisampled attachment that is resolved into
+	// the color target at the end of the subpass, so the samples never need to leave tile memory
+	bool resolve = samples != vk::SampleCountFlagBits::e1;
 	vk::AttachmentDescription colorAttachment{};
-	colorAttachment.format = currentSurfaceFormat.format;
+	colorAttachment.format = colorFormat;
+	colorAttachment.samples = samples;
 	colorAttachment.loadOp = vk::AttachmentLoadOp::eClear;
-	colorAttachment.storeOp = vk::AttachmentStoreOp::eStore;
+	colorAttachment.storeOp = resolve ? vk::AttachmentStoreOp::eDontCare : vk::AttachmentStoreOp::eStore;
 	colorAttachment.stencilLoadOp = vk::AttachmentLoadOp::eDontCare;
 	colorAttachment.stencilStoreOp = vk::AttachmentStoreOp::eDontCare;
-	colorAttachment.finalLayout = vk::ImageLayout::ePresentSrcKHR;
+	colorAttachment.initialLayout = vk::ImageLayout::eColorAttachmentOptimal;
+	colorAttachment.finalLayout = vk::ImageLayout::eColorAttachmentOptimal;
 	vk::AttachmentDescription depthAttachment{};
-	// TODO: should detect supported depth format
-	depthAttachment.format = vk::Format::eD32Sfloat;
+	depthAttachment.format = depthFormat;
+	depthAttachment.samples = samples;
 	depthAttachment.loadOp = vk::AttachmentLoadOp::eClear;
 	depthAttachment.storeOp = vk::AttachmentStoreOp::eDontCare;
 	depthAttachment.stencilLoadOp = vk::AttachmentLoadOp::eDontCare;
 	depthAttachment.stencilStoreOp = vk::AttachmentStoreOp::eDontCare;
+	depthAttachment.initialLayout = vk::ImageLayout::eDepthStencilAttachmentOptimal;
 	depthAttachment.finalLayout = vk::ImageLayout::eDepthStencilAttachmentOptimal;
-	std::array<vk::AttachmentDescription, 2> attachments = {colorAttachment, depthAttachment};
+	vk::AttachmentDescription resolveAttachment{};
+	resolveAttachment.format = colorFormat;
+	resolveAttachment.loadOp = vk::AttachmentLoadOp::eDontCare;
+	resolveAttachment.storeOp = vk::AttachmentStoreOp::eStore;
+	resolveAttachment.stencilLoadOp = vk::AttachmentLoadOp::eDontCare;
+	resolveAttachment.stencilStoreOp = vk::AttachmentStoreOp::eDontCare;
+	resolveAttachment.initialLayout = vk::ImageLayout::eColorAttachmentOptimal;
+	resolveAttachment.finalLayout = vk::ImageLayout::eColorAttachmentOptimal;
+	std::vector<vk::AttachmentDescription> attachments = {colorAttachment, depthAttachment};
+	if (resolve) {
+		attachments.push_back(resolveAttachment);
+	}
 
 	vk::AttachmentReference colorAttachmentRef{0, vk::ImageLayout::eColorAttachmentOptimal};
 	vk::AttachmentReference depthAttachmentRef{1, vk::ImageLayout::eDepthStencilAttachmentOptimal};
+	vk::AttachmentReference resolveAttachmentRef{2, vk::ImageLayout::eColorAttachmentOptimal};
 
 	vk::SubpassDescription subpass{};
 	subpass.colorAttachmentCount = 1;
 	subpass.pColorAttachments = &colorAttachmentRef;
+	subpass.pResolveAttachments = resolve ? &resolveAttachmentRef : nullptr;
 	subpass.pDepthStencilAttachment = &depthAttachmentRef;
-	vk::SubpassDependency dependency{};
-	dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
-	dependency.dstSubpass = 0;
-	dependency.srcStageMask = vk::PipelineStageFlagBits::eColorAttachmentOutput;
-	dependency.dstStageMask = vk::PipelineStageFlagBits::eColorAttachmentOutput;
-	dependency.srcAccessMask = {};
-	dependency.dstAccessMask = vk::AccessFlagBits::eColorAttachmentWrite;
 	vk::RenderPassCreateInfo renderpassInfo{};
 	renderpassInfo.attachmentCount = attachments.size();
 	renderpassInfo.pAttachments = attachments.data();
 	renderpassInfo.subpassCount = 1;
 	renderpassInfo.pSubpasses = &subpass;
+	// With multiview the subpass draws every view, each into its own layer of the targets
+	uint32_t mask = viewMask();
+	vk::RenderPassMultiviewCreateInfo multiviewInfo{};
+	multiviewInfo.subpassCount = 1;
+	multiviewInfo.pViewMasks = &mask;
+	// Views are rendered with nearby cameras, so let the implementation share work between them
+	multiviewInfo.correlationMaskCount = 1;
+	multiviewInfo.pCorrelationMasks = &mask;
+	if (multiview) {
+		renderpassInfo.pNext = &multiviewInfo;
+	}
 	renderpass = device->createRenderPassUnique(renderpassInfo);
 }
 
 
-void VulkanState::unsetRenderpass() {
-	renderpass.reset();
-}
-
-
-// Set up frame buffers from swap chain - need to do this on init and on resize
+// Set up the color target - need to do this on init and on resize
+// Each layer is a view's full share of the swap chain, the render scale only changes the area drawn to
 void VulkanState::setupFramebuffers() {
-	vk::ImageCreateInfo imageInfo{};
-	imageInfo.imageType = vk::ImageType::e2D;
-	imageInfo.format = vk::Format::eD32Sfloat;
-	imageInfo.extent.width = currentExtent.width;
-	imageInfo.extent.height = currentExtent.height;
-	imageInfo.extent.depth = 1;
-	imageInfo.mipLevels = 1;
-	imageInfo.arrayLayers = 1;
-	imageInfo.usage = vk::ImageUsageFlagBits::eDepthStencilAttachment | vk::ImageUsageFlagBits::eTransientAttachment;
-	depthImage = device->createImageUnique(imageInfo);
-
-	auto requirements = device->getImageMemoryRequirements(*depthImage);
-
-	vk::MemoryAllocateInfo allocateInfo{};
-	allocateInfo.allocationSize = requirements.size,
-	allocateInfo.memoryTypeIndex = findMemoryType(requirements.memoryTypeBits, vk::MemoryPropertyFlagBits::eDeviceLocal);
-
-	depthImageMemory = device->allocateMemoryUnique(allocateInfo);
+	colorTarget = createImage(
+		colorFormat,
+		viewExtent,
+		vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eTransferSrc,
+		vk::ImageAspectFlagBits::eColor,
+		viewCount
+	);
 
-	device->bindImageMemory(*depthImage, *depthImageMemory, 0);
+	// Separate passes each render into a single layer
+	if (passCount() > 1) {
+		for (uint32_t view = 0; view < viewCount; view++) {
+			colorLayerViews.push_back(createImageView(*colorTarget.image, colorFormat, vk::ImageAspectFlagBits::eColor, view));
+		}
+	}
+}
 
-	depthImageView = createImageView(*depthImage, vk::Format::eD32Sfloat, vk::ImageAspectFlagBits::eDepth);
 
+void VulkanState::unsetFramebuffers() {
 	framebuffers.clear();
+	colorLayerViews.clear();
+	colorTarget.reset();
+}
+
 
-	for (auto &image: swapchainImageViews) {
-		std::array<vk::ImageView, 2> attachments {
-			*image,
-			*depthImageView,
-		};
+// Frame buffer for the render pass with the given attachments, made on first use
+// Dynamic rendering takes the views directly, so it never needs one
+vk::Framebuffer VulkanState::framebuffer(vk::ImageView colorView, vk::ImageView depthView, vk::ImageView multisampledView) {
+	auto &framebuffer = framebuffers[{colorView, depthView, multisampledView}];
+	if (!framebuffer) {
+		// Same order as the render pass attachments, the color target is the resolve attachment with several samples
+		std::vector<vk::ImageView> attachments{colorView, depthView};
+		if (multisampledView) {
+			attachments = {multisampledView, depthView, colorView};
+		}
 		vk::FramebufferCreateInfo framebufferInfo{};
 		framebufferInfo.renderPass = *renderpass;
 		framebufferInfo.attachmentCount = attachments.size();
 		framebufferInfo.pAttachments = attachments.data();
-		framebufferInfo.width = currentExtent.width;
-		framebufferInfo.height = currentExtent.height;
+		framebufferInfo.width = viewExtent.width;
+		framebufferInfo.height = viewExtent.height;
+		// Multiview render passes take the layers from the view mask, so this stays 1
 		framebufferInfo.layers = 1;
-
-		framebuffers.emplace_back(device->createFramebufferUnique(framebufferInfo));
+		framebuffer = device->createFramebufferUnique(framebufferInfo);
 	}
+	return *framebuffer;
 }
 
 
-void VulkanState::unsetFramebuffers() {
-	framebuffers.clear();
-	depthImageView.reset();
-	depthImageMemory.reset();
-	depthImage.reset();
-}
-
-
-vk::UniqueImageView VulkanState::createImageView(vk::Image image, vk::Format format, vk::ImageAspectFlags aspects) {
+vk::UniqueImageView VulkanState::createImageView(vk::Image image, vk::Format format, vk::ImageAspectFlags aspects, uint32_t baseLayer, uint32_t layerCount) {
 	vk::ImageViewCreateInfo imageViewInfo{};
 	imageViewInfo.image = image;
 	imageViewInfo.format = format;
-	imageViewInfo.viewType = vk::ImageViewType::e2D;
+	imageViewInfo.viewType = layerCount > 1 ? vk::ImageViewType::e2DArray : vk::ImageViewType::e2D;
 	imageViewInfo.subresourceRange.aspectMask = aspects;
 	imageViewInfo.subresourceRange.baseMipLevel = 0;
 	imageViewInfo.subresourceRange.levelCount = 1;
-	imageViewInfo.subresourceRange.baseArrayLayer = 0;
-	imageViewInfo.subresourceRange.layerCount = 1;
+	imageViewInfo.subresourceRange.baseArrayLayer = baseLayer;
+	imageViewInfo.subresourceRange.layerCount = layerCount;
 	return device->createImageViewUnique(imageViewInfo);
 }
 
 
+ImageAndMemory VulkanState::createImage(vk::Format format, vk::Extent2D extent, vk::ImageUsageFlags usage, vk::ImageAspectFlags aspects, uint32_t layers) {
+	ImageAndMemory result{};
+
+	vk::ImageCreateInfo imageInfo{};
+	imageInfo.imageType = vk::ImageType::e2D;
+	imageInfo.format = format;
+	imageInfo.extent.width = extent.width;
+	imageInfo.extent.height = extent.height;
+	imageInfo.extent.depth = 1;
+	imageInfo.mipLevels = 1;
+	imageInfo.arrayLayers = layers;
+	imageInfo.usage = usage;
+	result.image = device->createImageUnique(imageInfo);
+
+	auto requirements = device->getImageMemoryRequirements(*result.image);
+	std::tie(result.memory, result.allocation) = allocateMemory(requirements, vk::MemoryPropertyFlagBits::eDeviceLocal);
+
+	device->bindImageMemory(*result.image, *result.memory, 0);
+
+	result.view = createImageView(*result.image, format, aspects, 0, layers);
+	return result;
+}
+
+
+// Read back timestamps of a finished frame into gpuFrameTime
+void VulkanState::readFrameTimer(size_t frameIndex) {
+	PerFrame &frame = perFrame[frameIndex];
+	if (!frame.timestampsWritten) {
+		return;
+	}
+	frame.timestampsWritten = false;
+
+	std::array<uint64_t, 2> timestamps{};
+	auto result = device->getQueryPoolResults(
+		*timestampPool,
+		frameIndex * 2, 2,
+		sizeof(timestamps), timestamps.data(), sizeof(timestamps[0]),
+		vk::QueryResultFlagBits::e64
+	);
+	if (result == vk::Result::eSuccess) {
+		gpuFrameTime = (timestamps[1] - timestamps[0]) * timestampPeriod / 1e6;
+		stats.gpuFrameTime.add(gpuFrameTime);
+	}
+}
+
+
 uint32_t VulkanState::findMemoryType(uint32_t mask, vk::MemoryPropertyFlags requiredProperties) {
+	auto memoryTypes = findMemoryTypes(mask, requiredProperties);
+	assertThat((!memoryTypes.empty()), "Could not find usable memory type\n");
+	return memoryTypes.front();
+}
+
+
+// All memory types that satisfy the given properties, drivers list the preferred ones first
+std::vector<uint32_t> VulkanState::findMemoryTypes(uint32_t mask, vk::MemoryPropertyFlags requiredProperties) {
 	auto memoryProperties = physicalDevice.getMemoryProperties();
+	std::vector<uint32_t> result{};
 	for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++) {
 		if ((mask & (1 << i)) &&
 		(memoryProperties.memoryTypes[i].propertyFlags & requiredProperties) == requiredProperties) {
-			return i;
+			result.push_back(i);
+		}
+	}
+	return result;
+}
+
+
+// Allocate memory for a resource and count it in its heap
+std::pair<vk::UniqueDeviceMemory, HeapAllocation> VulkanState::allocateMemory(vk::MemoryRequirements requirements, vk::MemoryPropertyFlags properties) {
+	auto memoryTypes = findMemoryTypes(requirements.memoryTypeBits, properties);
+	assertThat((!memoryTypes.empty()), "Could not find usable memory type\n");
+	auto memoryProperties = physicalDevice.getMemoryProperties();
+	auto heapOf = [&](uint32_t memoryType) {
+		return memoryProperties.memoryTypes[memoryType].heapIndex;
+	};
+
+	// Types whose heap is within budget first, otherwise make room in the preferred one
+	std::stable_partition(memoryTypes.begin(), memoryTypes.end(), [&](uint32_t memoryType) {
+		return memoryBudget.fits(heapOf(memoryType), requirements.size);
+	});
+	if (!memoryBudget.fits(heapOf(memoryTypes.front()), requirements.size)) {
+		memoryBudget.makeRoom(heapOf(memoryTypes.front()), requirements.size);
+	}
+
+	auto allocate = [&](uint32_t memoryType) -> std::optional<std::pair<vk::UniqueDeviceMemory, HeapAllocation>> {
+		try {
+			vk::MemoryAllocateInfo allocateInfo{requirements.size, memoryType};
+			auto memory = device->allocateMemoryUnique(allocateInfo);
+			return std::make_pair(std::move(memory), HeapAllocation{heapCounters, heapOf(memoryType), requirements.size});
+		} catch (vk::OutOfDeviceMemoryError &e) {
+			return {};
+		} catch (vk::OutOfHostMemoryError &e) {
+			return {};
+		}
+	};
+	for (auto memoryType: memoryTypes) {
+		if (auto result = allocate(memoryType)) {
+			return std::move(*result);
+		}
+	}
+
+	// Out of memory everywhere: wait for the frames in flight and free what earlier frames released.
+	// Evictions only free memory frames later, so evicting more here wouldn't help this allocation.
+	// Only the render thread may wait and collect.
+	uint32_t memoryType = memoryTypes.front();
+	if (memoryBudget.onRenderThread()) {
+		device->waitIdle();
+		// The current frame's releases may still be used by its unsubmitted command buffer
+		for (size_t frameIndex = 0; frameIndex < MAX_FRAMES_IN_FLIGHT; frameIndex++) {
+			if (frameIndex != currentFrame) {
+				deletionQueue.collect(frameIndex);
+			}
+		}
+		if (auto result = allocate(memoryType)) {
+			return std::move(*result);
 		}
 	}
-	assertThat(false, "Could not find usable memory type\n");
+	// Nothing left to free
+	vk::MemoryAllocateInfo allocateInfo{requirements.size, memoryType};
+	return {device->allocateMemoryUnique(allocateInfo), HeapAllocation{heapCounters, heapOf(memoryType), requirements.size}};
+}
+
+
+// Size and current usage of each memory heap
+std::vector<HeapStats> VulkanState::heapStats() const {
+	auto memoryProperties = physicalDevice.getMemoryProperties();
+	auto budgets = memoryBudget.heaps();
+	std::vector<HeapStats> result{};
+	for (uint32_t i = 0; i < memoryProperties.memoryHeapCount; i++) {
+		auto &heap = memoryProperties.memoryHeaps[i];
+		result.push_back({
+			heap.size,
+			heapCounters.bytes[i],
+			heapCounters.allocations[i],
+			budgets.at(i).budget,
+			budgets.at(i).usage,
+			bool(heap.flags & vk::MemoryHeapFlagBits::eDeviceLocal),
+		});
+	}
+	return result;
 }
 
 
@@ -479,4 +1019,8 @@ size_t VulkanState::nextFrame() {
 
 
 VulkanState::~VulkanState() {
+	if (device) {
+		device->waitIdle();
+		deletionQueue.flush();
+	}
 }
\ No newline at end of file
@@ -2,20 +2,64 @@
 
 // Helper code and boilerplate for Vulkan setup
 
+#include <chrono>
 #include <cstdint>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <optional>
+#include <tuple>
 #include <vector>
 
 #include <glm/glm.hpp>
 #include <vulkan/vulkan.hpp>
 
+#include "bindless.hpp"
+#include "budget.hpp"
+#include "deletion.hpp"
+#include "device.hpp"
+#include "stats.hpp"
+
 
 static const size_t MAX_FRAMES_IN_FLIGHT = 2;
 
+// Stages that can read push constants, so per draw bindless indices can be used in any of them
+static const vk::ShaderStageFlags PUSH_CONSTANT_STAGES = (
+	vk::ShaderStageFlagBits::eVertex |
+	vk::ShaderStageFlagBits::eTessellationControl |
+	vk::ShaderStageFlagBits::eTessellationEvaluation |
+	vk::ShaderStageFlagBits::eFragment
+);
+
+// Push constant size of all pipelines when using the bindless heap, the guaranteed minimum
+static const uint32_t BINDLESS_PUSH_CONSTANT_SIZE = 128;
+
+// Upper limit for each descriptor array in the bindless heap
+static const uint32_t BINDLESS_MAX_DESCRIPTORS = 4096;
+
 
 // Buffer and its backing memory
 struct BufferAndMemory {
 	vk::UniqueBuffer buffer;
 	vk::UniqueDeviceMemory memory;
+	HeapAllocation allocation;
+};
+
+
+// Image with its backing memory and a view covering the whole image
+struct ImageAndMemory {
+	vk::UniqueImage image;
+	vk::UniqueDeviceMemory memory;
+	vk::UniqueImageView view;
+	HeapAllocation allocation;
+
+	// Free held resources
+	void reset() {
+		view.reset();
+		image.reset();
+		memory.reset();
+		allocation.reset();
+	}
 };
 
 
@@ -29,6 +73,65 @@ struct PerFrame {
 	vk::UniqueSemaphore submitSemaphore;
 	// Command buffer that will be recorded and submitted for each frame
 	vk::CommandBuffer commandBuffer;
+	// Command buffer for the compute queue, and semaphore the graphics submission waits on
+	vk::CommandBuffer computeCommandBuffer;
+	vk::UniqueSemaphore computeSemaphore;
+	// Whether the command buffer wrote GPU timestamps that can be read back
+	bool timestampsWritten = false;
+};
+
+
+// Values for the specialization constants of a shader stage
+// Constants are all 32 bit (float, int, uint or VkBool32), so values are stored by their bits
+struct SpecializationConstants {
+	std::vector<vk::SpecializationMapEntry> entries{};
+	std::vector<uint32_t> data{};
+
+	// Set the constant with the given constant_id, replacing an earlier value
+	template<typename T>
+	SpecializationConstants &set(uint32_t id, T value) {
+		static_assert(sizeof(T) == sizeof(uint32_t), "Specialization constants must be 32 bit");
+		uint32_t bits;
+		memcpy(&bits, &value, sizeof(bits));
+		for (auto &entry: entries) {
+			if (entry.constantID == id) {
+				data.at(entry.offset / sizeof(uint32_t)) = bits;
+				return *this;
+			}
+		}
+		entries.push_back({id, (uint32_t) (data.size() * sizeof(uint32_t)), sizeof(uint32_t)});
+		data.push_back(bits);
+		return *this;
+	}
+
+	// Specialization info pointing into this, must stay alive while it's used
+	vk::SpecializationInfo info() const {
+		return {
+			(uint32_t) entries.size(), entries.data(),
+			data.size() * sizeof(uint32_t), data.data()
+		};
+	}
+};
+
+
+// SPIR-V code for one stage of a pipeline, with optional specialization constants
+struct ShaderStage {
+	vk::ShaderStageFlagBits stage;
+	std::vector<uint8_t> code;
+	SpecializationConstants constants{};
+};
+
+
+// How a pipeline uses the depth buffer
+enum class DepthMode {
+	// Test with less and write depth, for regular opaque geometry or a depth pre-pass
+	ReadWrite,
+	// Only shade fragments that match the depth laid down by a pre-pass, without writing
+	Equal,
+	// Test without writing, keeps early depth testing enabled for shaders using discard
+	ReadOnly,
+	// Ignore depth, for overlays drawn over everything
+	Disabled,
 };
 
 
@@ -50,44 +153,118 @@ struct Pipeline {
 class VulkanState
 {
 public:
+	// Memory taken from each heap by createBuffer and createImage
+	// Declared first so it outlives every allocation counted in it
+	HeapCounters heapCounters{};
+	// Budget and usage of each heap, evicts registered streamed resources under pressure
+	MemoryBudget memoryBudget{};
+	// Counters and timings of recent frames, see also heapStats
+	RendererStats stats{};
+
 	// Generic global instances
+	// Vulkan version usable with the device, at most 1.2
+	uint32_t apiVersion{};
 	vk::UniqueInstance instance{};
 	vk::PhysicalDevice physicalDevice{};
+	// Capabilities of the picked device
+	DeviceProfile deviceProfile{};
 	uint32_t queueFamily{};
 	vk::UniqueDevice device{};
+	// Functions of device extensions, which the loader doesn't export
+	vk::DispatchLoaderDynamic dispatch{};
 	vk::Queue queue{};
 	vk::UniqueCommandPool commandPool{};
+	// Queues for async compute and for streaming transfers, from dedicated families if the
+	// device has them, otherwise the same as the graphics family and queue
+	uint32_t computeQueueFamily{};
+	uint32_t transferQueueFamily{};
+	vk::Queue computeQueue{};
+	vk::Queue transferQueue{};
+	vk::UniqueCommandPool computeCommandPool{};
+	// Two timestamps per in-flight frame, null if the queue can't write timestamps
+	vk::UniqueQueryPool timestampPool{};
+	// Nanoseconds per timestamp tick
+	float timestampPeriod = 1.0;
+	// Global descriptor set shared by all pipelines, empty if descriptor indexing isn't supported
+	std::optional<BindlessHeap> bindless{};
 
 	// Swap chain state
 	vk::SurfaceKHR surface{};
 	vk::Extent2D currentExtent{};
+	// Each view's share of the swap chain width, the size of the color target's layers
+	vk::Extent2D viewExtent{};
 	vk::SurfaceFormatKHR currentSurfaceFormat;
 	vk::UniqueSwapchainKHR swapchain{};
 	std::vector<vk::Image> swapchainImages{};
-	std::vector<vk::UniqueImageView> swapchainImageViews{};
 	std::vector<vk::Fence> swapchainFences{};
 	bool shouldRecreateSwapchain = false;
 
-	// Dynamic pipeline state
+	// Fraction of the swap chain extent that is rendered, and the resulting render size
+	float renderScale = 1.0;
+	vk::Extent2D renderExtent{};
+
+	// Dynamic pipeline state, covering the render extent
 	vk::Viewport viewport{};
 	vk::Rect2D scissor{};
 
+	// Number of views rendered each frame, shown side by side, set with setViews
+	uint32_t viewCount = 1;
+	// Whether all views are drawn in one render pass with multiview, instead of a pass per view
+	bool multiview = false;
+	// Samples per pixel of color and depth while drawing, resolved into the color target at
+	// the end of each pass if more than one. Set with setSamples
+	vk::SampleCountFlagBits samples = vk::SampleCountFlagBits::e1;
+
+	// Formats of the render targets, fixed so pipelines don't depend on the surface
+	// The present blit converts to the swap chain format
+	vk::Format colorFormat = vk::Format::eB8G8R8A8Srgb;
+	// TODO: should detect supported depth format
+	vk::Format depthFormat = vk::Format::eD32Sfloat;
+
+	// Whether passes are recorded with VK_KHR_dynamic_rendering, otherwise they use the render pass and frame buffers
+	bool dynamicRendering = false;
+	// Only made without dynamic rendering, when the views are set
 	vk::UniqueRenderPass renderpass{};
 
-	// Depth and frame buffers
-	vk::UniqueImage depthImage{};
-	vk::UniqueDeviceMemory depthImageMemory{};
-	vk::UniqueImageView depthImageView{};
-	std::vector<vk::UniqueFramebuffer> framebuffers{};
+	// Color target with a layer per view, allocated at swap chain size so the render scale can change freely
+	// Depth only lives through a pass, so it is a transient image of the frame's render graph
+	ImageAndMemory colorTarget{};
+	// Views of single layers for rendering the views in separate passes
+	std::vector<vk::UniqueImageView> colorLayerViews{};
+	// Frame buffers without dynamic rendering, by color, depth and multisampled color view, made on first use
+	std::map<std::tuple<vk::ImageView, vk::ImageView, vk::ImageView>, vk::UniqueFramebuffer> framebuffers{};
+
+	// GPU duration of the last finished frame in milliseconds, 0 if not known
+	double gpuFrameTime = 0.0;
 
 	// Frame state
 	std::array<PerFrame, MAX_FRAMES_IN_FLIGHT> perFrame{};
+	// When the previous frame was acquired, for the CPU frame time
+	std::chrono::steady_clock::time_point lastAcquireTime{};
 	size_t currentFrame{MAX_FRAMES_IN_FLIGHT - 1};
+	// Resources released during each frame, freed when the frame comes around again
+	// Declared after the bindless heap and device so it is emptied before they go away
+	DeletionQueue<MAX_FRAMES_IN_FLIGHT> deletionQueue{};
 
 	~VulkanState();
 
 	// Initial setup, create device
-	void init();
+	// Picks the best device, or the first one whose name contains the override or whose UUID matches it
+	// Uses dynamic rendering when the device supports it, unless it's not allowed
+	void init(const char *deviceOverride = nullptr, bool allowDynamicRendering = true);
+
+	// Set the number of views and whether to render them with multiview, call before setSurface
+	// and before making pipelines. Multiview needs device support and at most deviceProfile.maxViews views
+	void setViews(uint32_t count, bool useMultiview);
+
+	// Set the samples per pixel, lowered to the most the device supports for both color and depth
+	// Call before setSurface and before making pipelines. Returns the number of samples used
+	uint32_t setSamples(uint32_t count);
+
+	// Number of render passes recorded per frame, all views at once with multiview or one per view
+	uint32_t passCount() const {
+		return multiview ? 1 : viewCount;
+	}
 
 	// Set surface and create swap chain
 	void setSurface(VkSurfaceKHR surface);
@@ -95,35 +272,126 @@ public:
 	// Tear down structures that depend on surface, so application can safely destroy it
 	void unsetSurface();
 
-	// Make a render pipeline
+	// Begin one of the passCount passes of a frame, clearing the color target and the given depth image
+	// With several samples the multisampled color image is drawn to instead, and resolved into the
+	// color target at the end of the pass; it is null with one sample. Covers the render extent.
+	// All must be in attachment layout already, see RenderGraph
+	void beginPass(
+		vk::CommandBuffer commandBuffer,
+		uint32_t pass,
+		vk::ImageView multisampledView,
+		vk::ImageView depthView,
+		const std::array<vk::ClearValue, 2> &clearValues
+	);
+
+	// End a pass started with beginPass
+	void endPass(vk::CommandBuffer commandBuffer);
+
+	// Destroy the frame buffers once frames in flight are done with them, call when their depth views go away
+	void releaseFramebuffers();
+
+	// Make a render pipeline from a vertex stage and optional tessellation and fragment stages
+	// Needs no surface, pipelines are made for the render target formats and the views
+	// Leave out the fragment stage to make a depth only pipeline
+	// Patch list topology needs tessellation stages and the number of control points per patch
 	Pipeline makePipeline(
-		std::vector<uint8_t> vertexShaderCode,
-		std::vector<uint8_t> fragmentShaderCode,
+		std::vector<ShaderStage> stages,
 		vk::PipelineVertexInputStateCreateInfo vertexInputInfo,
 		vk::PrimitiveTopology topology,
-		size_t pushConstantSize
+		size_t pushConstantSize,
+		DepthMode depthMode = DepthMode::ReadWrite,
+		uint32_t patchControlPoints = 0
 	);
 
+	// Make a compute pipeline with the given descriptor set layouts
+	Pipeline makeComputePipeline(
+		std::vector<uint8_t> shaderCode,
+		std::vector<vk::DescriptorSetLayout> setLayouts,
+		size_t pushConstantSize,
+		const SpecializationConstants &constants = {}
+	);
+
+	// Whether compute work runs on its own queue family, needing ownership transfers
+	bool hasAsyncCompute() const {
+		return computeQueueFamily != queueFamily;
+	}
+
+	// Bind the global bindless set, if supported, for all pipelines used in the command buffer
+	void bindGlobalDescriptors(vk::CommandBuffer commandBuffer, vk::PipelineBindPoint bindPoint, vk::PipelineLayout layout);
+
 	// Get next image from the swap chain, and frame specific structures
 	std::optional<std::pair<uint32_t, PerFrame&>> acquireImage();
 
 	// Recreate swap chain before next acquire attempt - call on window resize
 	void requestRecreateSwapchain();
 
+	// Set fraction of the swap chain extent to render at, takes effect for the next recorded frame
+	void setRenderScale(float scale);
+
+	// Record start and end timestamps for measuring the GPU frame time
+	void beginFrameTimer(vk::CommandBuffer commandBuffer);
+	void endFrameTimer(vk::CommandBuffer commandBuffer);
+
+	// Scale the rendered color target up to the swap chain image
+	// Each view is scaled to its own slice of the image, left to right
+	// The color target must be in transfer source and the image in transfer destination layout
+	void recordPresentBlit(vk::CommandBuffer commandBuffer, uint32_t imageIndex);
+
+	// Destroy a resource once every frame that may still use it has finished, without waiting
+	// Works for anything owning Vulkan objects: BufferAndMemory, ImageAndMemory, Pipeline, Unique handles
+	// Call from the render thread
+	template<typename T>
+	void destroyLater(T resource) {
+		deletionQueue.destroy(currentFrame, std::move(resource));
+	}
+
+	// Run a function once every frame that may still use a resource has finished
+	void runLater(std::function<void()> function) {
+		deletionQueue.defer(currentFrame, std::move(function));
+	}
+
+	// Size and current usage of each memory heap
+	std::vector<HeapStats> heapStats() const;
+
+	// Create a device local 2D image with a view, an array image and view if there is more than one layer
+	ImageAndMemory createImage(vk::Format format, vk::Extent2D extent, vk::ImageUsageFlags usage, vk::ImageAspectFlags aspects, uint32_t layers = 1);
+
+	// Create a buffer backed by memory with the given properties
+	BufferAndMemory createBuffer(vk::BufferUsageFlags usage, size_t size, vk::MemoryPropertyFlags memoryProperties);
+
 	// Create a buffer with inital data
-	BufferAndMemory createBufferWithData(vk::BufferUsageFlags usage, size_t size, uint8_t *data);
+	BufferAndMemory createBufferWithData(vk::BufferUsageFlags usage, size_t size, const uint8_t *data);
+
+	// Create image view for swap chain or depth image, an array view if it covers more than one layer
+	vk::UniqueImageView createImageView(vk::Image image, vk::Format format, vk::ImageAspectFlags aspects, uint32_t baseLayer = 0, uint32_t layerCount = 1);
+
+	// All memory types that satisfy the given properties, in order of preference
+	std::vector<uint32_t> findMemoryTypes(uint32_t mask, vk::MemoryPropertyFlags requiredProperties);
+
+	// Allocate memory for a resource, counted in its heap while the returned allocation is held
+	// Prefers memory types whose heap is under the budget's hard limit, queueing streamed
+	// resources for eviction to make room if none is. When the device is out of memory, the
+	// render thread retries once with the memory released by earlier frames.
+	std::pair<vk::UniqueDeviceMemory, HeapAllocation> allocateMemory(vk::MemoryRequirements requirements, vk::MemoryPropertyFlags properties);
 
 private:
 	void recreateSwapchain();
 	void createSwapchain();
 	void unsetSwapchain();
 	void createRenderpass();
-	void unsetRenderpass();
 	void setupFramebuffers();
 	void unsetFramebuffers();
 
-	// Create image view for swap chain or depth image
-	vk::UniqueImageView createImageView(vk::Image image, vk::Format format, vk::ImageAspectFlags aspects);
+	// Views drawn by a multiview pass
+	uint32_t viewMask() const {
+		return (1u << viewCount) - 1;
+	}
+
+	// Frame buffer for the render pass with the given attachments, the multisampled one may be null
+	vk::Framebuffer framebuffer(vk::ImageView colorView, vk::ImageView depthView, vk::ImageView multisampledView);
+
+	// Read back timestamps of a finished frame into gpuFrameTime
+	void readFrameTimer(size_t frameIndex);
 
 	// Find a memory type that satisfies the given properties
 	uint32_t findMemoryType(uint32_t mask, vk::MemoryPropertyFlags requiredProperties);